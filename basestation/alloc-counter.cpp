@@ -0,0 +1,52 @@
+#include "alloc-counter.hpp"
+
+#ifdef COUNT_ALLOCATIONS
+#include <cstdlib>
+#include <new>
+
+// Per thread, so the weather fetch worker doesn't show up in the counts of
+// the render loop.
+static thread_local size_t allocation_count = 0;
+
+static void* CountedAllocate(size_t size) {
+    ++allocation_count;
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+void* operator new(size_t size) {
+    void* result = CountedAllocate(size);
+    if (result == NULL) {
+        throw std::bad_alloc();
+    }
+    return result;
+}
+
+void* operator new[](size_t size) {
+    void* result = CountedAllocate(size);
+    if (result == NULL) {
+        throw std::bad_alloc();
+    }
+    return result;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return CountedAllocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return CountedAllocate(size);
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { std::free(ptr); }
+
+size_t Matrix::AllocationCount() {
+    return allocation_count;
+}
+#else
+size_t Matrix::AllocationCount() {
+    return 0;
+}
+#endif
@@ -0,0 +1,14 @@
+#ifndef ALLOC_COUNTER_H // include guard
+#define ALLOC_COUNTER_H
+
+#include <cstddef>
+
+namespace Matrix {
+    // Number of heap allocations (operator new) made so far by the calling
+    // thread. Only counted when built with "make COUNT_ALLOCATIONS=1", which
+    // also makes the scheduler report every module Render() that allocates.
+    // Always 0 otherwise.
+    size_t AllocationCount();
+} // namespace Matrix
+
+#endif
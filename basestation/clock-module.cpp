@@ -3,6 +3,8 @@
 #include <math.h>
 #include <numbers>
 
+#include "text-format.hpp"
+
 // Simple analog/digital clock
 
 ClockModule::ClockModule(rgb_matrix::RGBMatrix* m, bool includeDigitalClock) : MatrixModule(m) {
@@ -14,98 +16,75 @@ ClockModule::ClockModule(rgb_matrix::RGBMatrix* m, bool includeDigitalClock) : M
 
 	// Set default flag_include_digital_clock
 	flag_include_digital_clock = includeDigitalClock;
-}
 
-void ClockModule::SetCurrentNetworkTime() {
-	// current date and time on the current system
-	next_time.tv_sec = time(NULL);
-	next_time.tv_nsec = 0;
-}
+	// Precompute where the hands end for every position they can be in
+	ComputeHandEnds(hour_hand_ends, 12 * 60, hour_hand_circle_radius);
+	ComputeHandEnds(minute_hand_ends, 60, minute_hand_circle_radius);
+	ComputeHandEnds(second_hand_ends, 60, second_hand_circle_radius);
 
-void ClockModule::DrawClockHourHand(double hour_fraction) {
-	// Calculate point on circle circumference
-	int hour_end_x = round(
-		circle_center_x + (hour_hand_circle_radius *
-			cos(hour_fraction * (2.0 * std::numbers::pi) + (0.5 * std::numbers::pi))));
-	int hour_end_y = round(
-		circle_center_y + (hour_hand_circle_radius *
-			sin(hour_fraction * (2.0 * std::numbers::pi) - (0.5 * std::numbers::pi))));
-
-	// Need to draw 4 lines because the middle is represented as a 2 by 2 pixel block
-	for (int i = 0; i < 2; i++) {
-		for (int j = 0; j < 2; j++) {
-			rgb_matrix::DrawLine(off_screen_canvas, circle_center_x + i,
-				circle_center_y + j, hour_end_x + i,
-				hour_end_y + j, clock_color);
-		}
-	}
+	clock_face_canvas = m->CreateFrameCanvas();
+	DrawClockFace();
 }
 
-void ClockModule::DrawClockMinHand(double minute_fraction) {
-	// Calculate point on circle circumference
-	int minute_end_x = round(
-		circle_center_x + (minute_hand_circle_radius *
-			cos(minute_fraction * (2 * std::numbers::pi) + (0.5 * std::numbers::pi))));
-	int minute_end_y = round(
-		circle_center_y + (minute_hand_circle_radius *
-			sin(minute_fraction * (2 * std::numbers::pi) - (0.5 * std::numbers::pi))));
-
-	// Need to draw 4 lines because the middle is represented as a 2 by 2 pixel
-	// block
-	for (int i = 0; i < 2; i++) {
-		for (int j = 0; j < 2; j++) {
-			rgb_matrix::DrawLine(off_screen_canvas, circle_center_x + i,
-				circle_center_y + j, minute_end_x + i,
-				minute_end_y + j, clock_color);
-		}
+void ClockModule::ComputeHandEnds(HandEnd* ends, int count, int radius) {
+	for (int i = 0; i < count; i++) {
+		// Hands turn clockwise, starting at the top
+		double fraction = 0 - (double)i / count;
+
+		// Calculate point on circle circumference
+		ends[i].x = round(
+			circle_center_x + (radius *
+				cos(fraction * (2.0 * std::numbers::pi) + (0.5 * std::numbers::pi))));
+		ends[i].y = round(
+			circle_center_y + (radius *
+				sin(fraction * (2.0 * std::numbers::pi) - (0.5 * std::numbers::pi))));
 	}
 }
 
-void ClockModule::DrawClockSecHand(double second_fraction) {
-	// Calculate point on circle circumference
-	int second_end_x = round(
-		circle_center_x + (second_hand_circle_radius *
-			cos(second_fraction * (2.0 * std::numbers::pi) + (0.5 * std::numbers::pi))));
-	int second_end_y = round(
-		circle_center_y + (second_hand_circle_radius *
-			sin(second_fraction * (2.0 * std::numbers::pi) - (0.5 * std::numbers::pi))));
-
-	// Need only draw one line because this is the second hand.
-	rgb_matrix::DrawLine(off_screen_canvas, circle_center_x, circle_center_y,
-		second_end_x, second_end_y, clock_color);
-}
-
-void ClockModule::DrawClock() {
-    // Fill canvas blank
-    off_screen_canvas->Fill(0, 0, 0);
+void ClockModule::DrawClockFace() {
+	// Fill canvas blank
+	clock_face_canvas->Fill(0, 0, 0);
 
 	// Draw ticks around the perimeter of the screen
-	rgb_matrix::SetImage(off_screen_canvas, 0, 0,
+	rgb_matrix::SetImage(clock_face_canvas, 0, 0,
 		matrix_images::analog_clock_base,
 		matrix_images::analog_clock_base_size,
 		matrix_images::analog_clock_base_width,
 		matrix_images::analog_clock_base_height, false);
+}
 
-	// Get fraction of hour
-	double hour_fraction = (double)((local_time.tm_hour % 12) + (double)(local_time.tm_min) / 60) / 12;
-	hour_fraction = 0 - hour_fraction;
+void ClockModule::DrawClockHourHand(const HandEnd& end) {
+	// Two pixels thick because the middle is represented as a 2 by 2 pixel block
+	rgb_matrix::DrawLine(off_screen_canvas, circle_center_x, circle_center_y,
+		end.x, end.y, 2, clock_color);
+}
 
-	// Get fraction of minute
-	double minute_fraction = (double)local_time.tm_min / 60;
-	minute_fraction = 0 - minute_fraction;
+void ClockModule::DrawClockMinHand(const HandEnd& end) {
+	// Two pixels thick because the middle is represented as a 2 by 2 pixel
+	// block
+	rgb_matrix::DrawLine(off_screen_canvas, circle_center_x, circle_center_y,
+		end.x, end.y, 2, clock_color);
+}
 
-	// Get fraction of second
-	double second_fraction = (double)local_time.tm_sec / 60;
-	second_fraction = 0 - second_fraction;
+void ClockModule::DrawClockSecHand(const HandEnd& end) {
+	// Need only draw one line because this is the second hand.
+	rgb_matrix::DrawLine(off_screen_canvas, circle_center_x, circle_center_y,
+		end.x, end.y, clock_color);
+}
+
+void ClockModule::DrawClock() {
+	// Start from the pre-rendered face (one block copy)
+	off_screen_canvas->CopyFrom(*clock_face_canvas);
 
 	// ~~ Draw hour line ~~ //
-	DrawClockHourHand(hour_fraction);
+	DrawClockHourHand(hour_hand_ends[(local_time.tm_hour % 12) * 60 + local_time.tm_min]);
 
 	// ~~ Draw minute line ~~ //
-	DrawClockMinHand(minute_fraction);
+	DrawClockMinHand(minute_hand_ends[local_time.tm_min % 60]);
 
 	// ~~ Draw second line ~~ //
-	DrawClockSecHand(second_fraction);
+	// (tm_sec can be 60 on a leap second)
+	DrawClockSecHand(second_hand_ends[local_time.tm_sec % 60]);
 
 	if (flag_include_digital_clock) {
 		DrawDigitalClock();
@@ -116,46 +95,33 @@ void ClockModule::DrawDigitalClock() {
 	// ~~ Erase digital clock bounding box ~~ //
 	// (set all pixel values to black) in the square where the local_time will
 	// go
-	rgb_matrix::SetImage(off_screen_canvas, clock_text_canvas_offset_x,
+	rgb_matrix::FillRectangle(off_screen_canvas, clock_text_canvas_offset_x,
 		clock_text_canvas_offset_y,
-		matrix_images::digital_clock_bbox_erase,
-		matrix_images::digital_clock_bbox_erase_size,
 		matrix_images::digital_clock_bbox_erase_width,
-		matrix_images::digital_clock_bbox_erase_height, false);
+		matrix_images::digital_clock_bbox_erase_height,
+		rgb_matrix::Color(0, 0, 0));
 
 	// ~~ Draw text in the center of the screen //
     int local_hour = (local_time.tm_hour % 12) == 0 ? 12 : (local_time.tm_hour % 12); // Convert 24 hour time to 12 hour time
-	int local_minute = local_time.tm_min;
-	std::string hours = std::to_string(local_hour);
-	std::string minutes = std::to_string(local_minute);
-	if (local_hour < 10) {
-		hours = "0" + std::to_string(local_hour);
-	}
-	if (local_minute < 10) {
-		minutes = "0" + std::to_string(local_minute);
-	}
-
-	std::string local_time_str = hours + ":" + minutes;
+	char local_time_str[6];
+	TextFormat::HourMinute(local_time_str, local_hour, local_time.tm_min);
 	rgb_matrix::DrawText(
 		off_screen_canvas, font, clock_text_canvas_offset_x + 1,
 		clock_text_canvas_offset_y + 1 + font.baseline(), text_color, NULL,
-		local_time_str.c_str(), letter_spacing);
+		local_time_str, letter_spacing);
 }
 
-rgb_matrix::FrameCanvas* ClockModule::Update() {
-    // Update the time seconds
-    SetCurrentNetworkTime();
-    next_time.tv_sec += 1;
+Deadline ClockModule::NextDeadline(const struct timespec& now) {
+	// The next whole second
+	return { { now.tv_sec + 1, 0 }, WakeReason::TICK };
+}
 
-    // Set readable local_time from next_time.tv_sec
-    localtime_r(&next_time.tv_sec, &local_time);
+rgb_matrix::FrameCanvas* ClockModule::Render(const Deadline& deadline) {
+	// Set readable local_time from the time the frame is shown
+	localtime_r(&deadline.time.tv_sec, &local_time);
 
-    // Draw the clock (using the local_time set from the next time).
-    DrawClock();
+	// Draw the clock (using the local_time set from the deadline).
+	DrawClock();
 
-    // Wait to update time.
-    clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &next_time, NULL);
-    
-    // Set update ready to true
-    return off_screen_canvas;
+	return off_screen_canvas;
 }
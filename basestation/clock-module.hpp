@@ -14,7 +14,6 @@ private:
     rgb_matrix::Color clock_color;
 
     // Time Variables
-    struct timespec next_time;
     struct tm local_time;
 
     bool flag_include_digital_clock;
@@ -30,16 +29,35 @@ private:
     int circle_center_x = (matrix_width - 1) / 2;
     int circle_center_y = (matrix_height - 1) / 2;
 
-    void SetCurrentNetworkTime();
+    // The static part of the clock (the face), drawn once and copied to the
+    // canvas on every tick. The digital clock background can't be part of it:
+    // it is erased after the hands are drawn, to blank them out behind the
+    // time.
+    rgb_matrix::FrameCanvas* clock_face_canvas;
 
-    void DrawClockHourHand(double hour_fraction);
-    void DrawClockMinHand(double minute_fraction);
-    void DrawClockSecHand(double second_fraction);
+    // Precomputed hand end points: the hour hand for every minute of the
+    // 12 hours, the minute and second hand for every minute/second.
+    struct HandEnd {
+        int x;
+        int y;
+    };
+    HandEnd hour_hand_ends[12 * 60];
+    HandEnd minute_hand_ends[60];
+    HandEnd second_hand_ends[60];
+
+    void ComputeHandEnds(HandEnd* ends, int count, int radius);
+    void DrawClockFace();
+
+    void DrawClockHourHand(const HandEnd& end);
+    void DrawClockMinHand(const HandEnd& end);
+    void DrawClockSecHand(const HandEnd& end);
     void DrawClock();
 
     void DrawDigitalClock();
 
-    rgb_matrix::FrameCanvas* Update();
+    // Show every second
+    Deadline NextDeadline(const struct timespec& now);
+    rgb_matrix::FrameCanvas* Render(const Deadline& deadline);
 
 public:
     ClockModule(rgb_matrix::RGBMatrix* m, bool includeDigitalClock);
@@ -3,16 +3,11 @@
 #include "led-matrix.h"
 
 #include "clock-module.hpp"
+#include "scheduler.hpp"
 #include "weather-station-module.hpp"
 
 #define REFRESH_RATE 90
 
-struct timespec current_time;
-struct timespec next_time;
-
-volatile bool interrupt_received = false;
-static void InterruptHandler(int signo) { interrupt_received = true; }
-
 int main(int argc, char* argv[]) {
 	using namespace rgb_matrix;
 
@@ -45,6 +40,14 @@ int main(int argc, char* argv[]) {
 		return 1;
 	}
 
+	// Stop on CTRL-C or SIGTERM. The scheduler waits for these on a signalfd,
+	// so block them before any thread is started; all threads inherit this.
+	sigset_t stop_signals;
+	sigemptyset(&stop_signals);
+	sigaddset(&stop_signals, SIGINT);
+	sigaddset(&stop_signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &stop_signals, NULL);
+
 	// Initialize RGBMatrix
 	RGBMatrix* matrix = RGBMatrix::CreateFromOptions(matrix_options, runtime_opt);
 	if (matrix == NULL) return 1;
@@ -56,40 +59,16 @@ int main(int argc, char* argv[]) {
 	MatrixModule* weatherModule = new WeatherStation::WeatherStationModule(matrix);
 	MatrixModule* clockModule = new ClockModule(matrix, true);
 
-    // Setup module tracking for display
-    //  1 = Clock Module;
-    //  2 = Weather Module;
-    int currentActiveModule = 1;
-    MatrixModule* currentModule = clockModule;
-
-    clock_gettime(CLOCK_REALTIME, &current_time);
-    next_time.tv_sec = current_time.tv_sec + 15; // Change to the next module after 15 seconds
-
-    // Set up an interrupt handler to be able to stop animations while they go on.
-	signal(SIGTERM, InterruptHandler);
-	signal(SIGINT, InterruptHandler);
+    // Rotate through the modules:
+    //  Clock Module for 15 seconds, then Weather Module for 45 seconds
+    Scheduler scheduler(matrix);
+    scheduler.AddModule(clockModule, 15);
+    scheduler.AddModule(weatherModule, 45);
 
 	printf("Press <CTRL-C> to exit and reset LEDs\n");
 
 	// ~~~ MAIN LOOP ~~~ //
-	while (!interrupt_received) {
-        clock_gettime(CLOCK_REALTIME, &current_time);
-
-        if (current_time.tv_sec >= next_time.tv_sec) {
-            if (currentActiveModule == 1) {
-                currentActiveModule = 2;
-                currentModule = weatherModule;
-                next_time.tv_sec = current_time.tv_sec + 45; // Change to the next module after 45 seconds
-            } else {
-                currentActiveModule = 1;
-                currentModule = clockModule;
-                next_time.tv_sec = current_time.tv_sec + 15; // Change to the next module after 15 seconds
-            }
-        }
-        
-        // Update the canvas only if the module has posted an update
-        matrix->SwapOnVSync(currentModule->Update());
-	}
+	scheduler.Run(stop_signals);
 	// ~~~ END ~~~ //
 
 	// Delete all objects initialized with 'new'
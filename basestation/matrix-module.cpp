@@ -3,53 +3,94 @@
 #include <iostream>
 #include <fstream>
 #include <ctime>
+#include <filesystem>
+#include <utility>
 
 using namespace Matrix;
 
 int MatrixModule::matrix_width;
 int MatrixModule::matrix_height;
 
-MatrixModule::MatrixModule(rgb_matrix::RGBMatrix* m) {
-	// Setup font
-	const char* bdf_font_file = "../fonts/tom-thumb_fixed_4x6.bdf";
+std::mutex FontRegistry::fonts_mutex;
+std::map<std::string, std::weak_ptr<const rgb_matrix::Font>> FontRegistry::fonts;
 
+std::shared_ptr<const rgb_matrix::Font> FontRegistry::Acquire(const char* bdf_font_file) {
 	if (bdf_font_file == NULL) {
 		std::string errMsg = std::string("Unrecognized font file\n");
 		std::cerr << errMsg.c_str();
 		throw std::invalid_argument(errMsg);
 	}
 
-	// Load font. This needs to be a filename with a bdf bitmap font.
-	if (!font.LoadFont(bdf_font_file)) {
-		std::string errMsg =
-			std::string("Couldn't load font \'") + bdf_font_file + "\'\n";
-		std::cerr << errMsg.c_str();
-		throw std::invalid_argument(errMsg);
+	// Different spellings of the same path share one font.
+	std::error_code ec;
+	std::string key = std::filesystem::weakly_canonical(bdf_font_file, ec).string();
+	if (ec) {
+		key = bdf_font_file;
 	}
 
-	// Store a reference to a new off_screen_canvas
-	//    (one for each module initialized)
-	off_screen_canvas = m->CreateFrameCanvas();
-}
+	std::lock_guard<std::mutex> lock(fonts_mutex);
+	auto found = fonts.find(key);
+	if (found != fonts.end()) {
+		std::shared_ptr<const rgb_matrix::Font> font = found->second.lock();
+		if (font) {
+			return font;
+		}
+	}
 
-MatrixModule::MatrixModule(rgb_matrix::RGBMatrix* m, const char* bdf_font_file) {
-	if (bdf_font_file == NULL) {
-		std::string errMsg = std::string("Unrecognized font file\n");
-		std::cerr << errMsg.c_str();
-		throw std::invalid_argument(errMsg);
+	// Fonts nobody holds on to any more are not kept around
+	for (auto it = fonts.begin(); it != fonts.end();) {
+		if (it->second.expired()) {
+			it = fonts.erase(it);
+		} else {
+			++it;
+		}
 	}
 
-    // Load font. This needs to be a filename with a bdf bitmap font.
-	if (!font.LoadFont(bdf_font_file)) {
+	// Load font. This needs to be a filename with a bdf bitmap font. A font
+	// precompiled next to it (see fonts/Makefile) loads without parsing, so
+	// prefer that one unless the bdf file has been changed since.
+	std::shared_ptr<rgb_matrix::Font> loaded = std::make_shared<rgb_matrix::Font>();
+	std::filesystem::path binary_font_file(bdf_font_file);
+	binary_font_file.replace_extension(".rgbfont");
+	std::error_code binary_ec, bdf_ec;
+	const auto binary_time = std::filesystem::last_write_time(binary_font_file, binary_ec);
+	const auto bdf_time = std::filesystem::last_write_time(bdf_font_file, bdf_ec);
+	const bool use_binary = !binary_ec && (bdf_ec || binary_time >= bdf_time);
+	if (use_binary && loaded->LoadFont(binary_font_file.c_str())) {
+		fonts[key] = loaded;
+		return loaded;
+	}
+	loaded = std::make_shared<rgb_matrix::Font>();
+	if (!loaded->LoadFont(bdf_font_file)) {
 		std::string errMsg =
 			std::string("Couldn't load font \'") + bdf_font_file + "\'\n";
 		std::cerr << errMsg.c_str();
 		throw std::invalid_argument(errMsg);
 	}
+	fonts[key] = loaded;
+	return loaded;
+}
+
+static const char* default_bdf_font_file = "../fonts/tom-thumb_fixed_4x6.bdf";
 
-    // Store a reference to a new off_screen_canvas
-	//    (one for each module initialized)
+MatrixModule::MatrixModule(rgb_matrix::RGBMatrix* m)
+	: MatrixModule(m, default_bdf_font_file) {}
+
+MatrixModule::MatrixModule(rgb_matrix::RGBMatrix* m, const char* bdf_font_file)
+	: font_handle(FontRegistry::Acquire(bdf_font_file)), font(*font_handle) {
+	// Store a reference to two new canvases
+	//    (for each module initialized)
 	off_screen_canvas = m->CreateFrameCanvas();
+	on_screen_canvas = m->CreateFrameCanvas();
+}
+
+void MatrixModule::FramePresented() {
+	std::swap(off_screen_canvas, on_screen_canvas);
+
+	// Only the rows drawn for the frame just shown differ between the two
+	off_screen_canvas->CopyRowsFrom(*on_screen_canvas, on_screen_canvas->DirtyRows());
+	off_screen_canvas->ClearDirtyRows();
+	on_screen_canvas->ClearDirtyRows();
 }
 
 MatrixModule::~MatrixModule() {}
@@ -1,21 +1,56 @@
 #ifndef MATRIX_MODULE_H // include guard
 #define MATRIX_MODULE_H
 
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <time.h>
 
 #include "graphics.h"
 #include "led-matrix.h"
 #include "pixel-mapper.h"
 
 namespace Matrix {
+    // Process-wide cache of loaded fonts, keyed by path. Each font is parsed
+    // once and shared by all modules using it; it is freed again when the
+    // last module holding it goes away.
+    class FontRegistry {
+    public:
+        // Returns the font at "bdf_font_file", loading it if it isn't cached.
+        // Throws std::invalid_argument if the font can't be loaded.
+        static std::shared_ptr<const rgb_matrix::Font> Acquire(const char* bdf_font_file);
+
+    private:
+        static std::mutex fonts_mutex;
+        static std::map<std::string, std::weak_ptr<const rgb_matrix::Font>> fonts;
+    };
+
+    // Why a module wants a new frame shown
+    enum class WakeReason {
+        TICK,       // Time moved on, e.g. the next second of a clock
+        DATA,       // New data arrived that should be shown right away
+        TRANSITION  // The scheduler switches to another module
+    };
+
+    struct Deadline {
+        struct timespec time;
+        WakeReason reason;
+    };
+
     class MatrixModule {
     protected:
         static int matrix_width;
         static int matrix_height;
 
+        // Frames are drawn ahead of time on off_screen_canvas, while
+        // on_screen_canvas holds the last frame shown.
         rgb_matrix::FrameCanvas* off_screen_canvas;
+        rgb_matrix::FrameCanvas* on_screen_canvas;
 
-        rgb_matrix::Font font;
+        // Keeps the shared default font alive; use "font" to draw.
+        std::shared_ptr<const rgb_matrix::Font> font_handle;
+        const rgb_matrix::Font& font;
 
         MatrixModule(rgb_matrix::RGBMatrix* m);
         MatrixModule(rgb_matrix::RGBMatrix* m, const char* bdf_font_file);
@@ -27,7 +62,21 @@ namespace Matrix {
         // Initialize all necessary static member variables
         static void InitStaticMatrixVariables(rgb_matrix::RGBMatrix* m);
 
-        virtual rgb_matrix::FrameCanvas* Update() = 0;
+        // The next time after "now" this module wants a new frame shown.
+        virtual Deadline NextDeadline(const struct timespec& now) = 0;
+
+        // Draw the frame to be shown at "deadline" and return it. Called ahead
+        // of time; the frame might be dropped if new data arrives meanwhile.
+        virtual rgb_matrix::FrameCanvas* Render(const Deadline& deadline) = 0;
+
+        // An eventfd(2) that becomes readable when new data arrives, or -1.
+        // The scheduler waits on it besides the deadline, and resets it.
+        virtual int EventFd() { return -1; }
+
+        // Called once the frame from Render() is shown. Drawing continues on
+        // the other canvas, updated to match what is shown, so modules can
+        // keep redrawing only the parts that change.
+        void FramePresented();
 
         virtual ~MatrixModule();
     };
@@ -0,0 +1,161 @@
+#include "scheduler.hpp"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <stdexcept>
+#include <string>
+
+#include "alloc-counter.hpp"
+
+using namespace Matrix;
+
+// epoll data of the timer and the signalfd; module event fds use the module index.
+static const uint64_t timer_id = UINT64_MAX;
+static const uint64_t signal_id = UINT64_MAX - 1;
+
+static void WatchFd(int epoll_fd, int fd, uint64_t id) {
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.u64 = id;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+        throw std::runtime_error(std::string("Couldn't watch fd in scheduler: ") + strerror(errno));
+    }
+}
+
+static bool Before(const struct timespec& a, const struct timespec& b) {
+    return a.tv_sec < b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_nsec < b.tv_nsec);
+}
+
+Scheduler::Scheduler(rgb_matrix::RGBMatrix* m) : matrix(m) {
+    timer_fd = timerfd_create(CLOCK_REALTIME, TFD_CLOEXEC);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (timer_fd < 0 || epoll_fd < 0) {
+        throw std::runtime_error(std::string("Couldn't set up scheduler: ") + strerror(errno));
+    }
+    WatchFd(epoll_fd, timer_fd, timer_id);
+}
+
+Scheduler::~Scheduler() {
+    if (signal_fd >= 0) {
+        close(signal_fd);
+    }
+    close(epoll_fd);
+    close(timer_fd);
+}
+
+void Scheduler::AddModule(MatrixModule* module, int display_seconds) {
+    modules.push_back({ module, display_seconds });
+
+    if (module->EventFd() >= 0) {
+        WatchFd(epoll_fd, module->EventFd(), modules.size() - 1);
+    }
+}
+
+Scheduler::WaitResult Scheduler::WaitUntil(const struct timespec& deadline, size_t active) {
+    struct itimerspec timer = {};
+    timer.it_value = deadline;
+    if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &timer, NULL) != 0) {
+        throw std::runtime_error(std::string("timerfd_settime() failed: ") + strerror(errno));
+    }
+
+    for (;;) {
+        struct epoll_event events[8];
+        int count = epoll_wait(epoll_fd, events, 8, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error(std::string("epoll_wait() failed: ") + strerror(errno));
+        }
+
+        bool deadline_passed = false;
+        bool active_event = false;
+        for (int i = 0; i < count; i++) {
+            uint64_t value;
+            if (events[i].data.u64 == timer_id) {
+                deadline_passed = read(timer_fd, &value, sizeof(value)) == sizeof(value);
+            } else if (events[i].data.u64 == signal_id) {
+                return INTERRUPTED;
+            } else {
+                // Inactive modules pick up their data once they are shown
+                const size_t index = events[i].data.u64;
+                if (read(modules[index].module->EventFd(), &value, sizeof(value)) == sizeof(value) && index == active) {
+                    active_event = true;
+                }
+            }
+        }
+
+        if (active_event) {
+            return EVENT;
+        }
+        if (deadline_passed) {
+            return DEADLINE;
+        }
+    }
+}
+
+void Scheduler::Run(const sigset_t& stop_signals) {
+    if (modules.empty()) {
+        return;
+    }
+
+    // A signal arriving at any time, on any thread, stays pending on the
+    // signalfd until the wait picks it up.
+    if (signal_fd < 0) {
+        signal_fd = signalfd(-1, &stop_signals, SFD_CLOEXEC);
+        if (signal_fd < 0) {
+            throw std::runtime_error(std::string("Couldn't create signalfd: ") + strerror(errno));
+        }
+        WatchFd(epoll_fd, signal_fd, signal_id);
+    }
+
+    // Start by transitioning to the first module right away
+    size_t active = modules.size() - 1;
+    struct timespec transition;
+    clock_gettime(CLOCK_REALTIME, &transition);
+
+    for (;;) {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+
+        Deadline deadline = modules[active].module->NextDeadline(now);
+        size_t shown = active;
+        if (!Before(deadline.time, transition)) {
+            deadline = { transition, WakeReason::TRANSITION };
+            shown = (active + 1) % modules.size();
+        }
+
+        // Render ahead of time, then present right on the deadline
+#ifdef COUNT_ALLOCATIONS
+        const size_t allocations = AllocationCount();
+#endif
+        rgb_matrix::FrameCanvas* frame = modules[shown].module->Render(deadline);
+#ifdef COUNT_ALLOCATIONS
+        if (AllocationCount() != allocations) {
+            fprintf(stderr, "Module %zu: %zu allocation(s) in Render()\n", shown, AllocationCount() - allocations);
+        }
+#endif
+        const WaitResult result = WaitUntil(deadline.time, active);
+        if (result == INTERRUPTED) {
+            return;
+        }
+        if (result == EVENT) {
+            continue; // New data: drop the frame and start over
+        }
+        matrix->SwapOnVSync(frame);
+        modules[shown].module->FramePresented();
+
+        if (shown != active) {
+            active = shown;
+            transition = deadline.time;
+            transition.tv_sec += modules[active].display_seconds;
+        }
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef SCHEDULER_H // include guard
+#define SCHEDULER_H
+
+#include <signal.h>
+
+#include <vector>
+
+#include "led-matrix.h"
+#include "matrix-module.hpp"
+
+namespace Matrix {
+    // Owns the timeline: rotates through the modules, has the active one
+    // render its next frame ahead of time and presents it on its deadline.
+    // Waiting is done with a timerfd and epoll, so data arriving for a module
+    // or a signal to stop wakes the scheduler up as well.
+    class Scheduler {
+    public:
+        Scheduler(rgb_matrix::RGBMatrix* m);
+        ~Scheduler();
+
+        // Add a module to the rotation, shown for "display_seconds" at a time.
+        void AddModule(MatrixModule* module, int display_seconds);
+
+        // Run until one of "stop_signals" arrives. They are taken from a
+        // signalfd, so they must be blocked in all threads, i.e. before any
+        // thread is started. Throws std::runtime_error if waiting for them
+        // can't be set up.
+        void Run(const sigset_t& stop_signals);
+
+    private:
+        enum WaitResult {
+            DEADLINE,    // The deadline passed
+            EVENT,       // A module's event fd became readable
+            INTERRUPTED  // A signal to stop arrived
+        };
+
+        struct Entry {
+            MatrixModule* module;
+            int display_seconds;
+        };
+
+        // Wait for the deadline, or for new data for module "active".
+        WaitResult WaitUntil(const struct timespec& deadline, size_t active);
+
+        rgb_matrix::RGBMatrix* matrix;
+        std::vector<Entry> modules;
+
+        int timer_fd;
+        int epoll_fd;
+        int signal_fd = -1;
+    };
+
+} // namespace Matrix
+
+#endif
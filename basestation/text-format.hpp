@@ -0,0 +1,76 @@
+#ifndef TEXT_FORMAT_H // include guard
+#define TEXT_FORMAT_H
+
+// Formatting of the short strings shown on the matrix (times, dates,
+// temperatures). Everything is written into fixed-size buffers owned by the
+// caller, so none of this ever touches the heap.
+namespace Matrix {
+namespace TextFormat {
+
+    // Write "value" with at least "min_digits" digits (zero-padded).
+    // Returns the position after the last character written.
+    inline char* AppendInt(char* out, int value, int min_digits = 1) {
+        unsigned int magnitude = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+        if (value < 0) {
+            *out++ = '-';
+        }
+        char digits[10];
+        int count = 0;
+        do {
+            digits[count++] = '0' + magnitude % 10;
+            magnitude /= 10;
+        } while (magnitude != 0);
+        while (count < min_digits) {
+            digits[count++] = '0';
+        }
+        while (count > 0) {
+            *out++ = digits[--count];
+        }
+        return out;
+    }
+
+    // "HH:MM"
+    inline const char* HourMinute(char (&out)[6], int hour, int minute) {
+        char* pos = AppendInt(out, hour % 100, 2);
+        *pos++ = ':';
+        pos = AppendInt(pos, minute % 100, 2);
+        *pos = '\0';
+        return out;
+    }
+
+    // "MM-D"; the month is zero-padded, the day isn't.
+    inline const char* MonthDay(char (&out)[6], int month, int day) {
+        char* pos = AppendInt(out, month % 100, 2);
+        *pos++ = '-';
+        pos = AppendInt(pos, day % 100);
+        *pos = '\0';
+        return out;
+    }
+
+    // "SUN" to "SAT" for tm_wday 0 to 6; "---" for anything else.
+    inline const char* Weekday(int wday) {
+        static const char* const weekdays[7] = { "SUN", "MON", "TUE", "WED", "THU", "FRI", "SAT" };
+        return (wday >= 0 && wday < 7) ? weekdays[wday] : "---";
+    }
+
+    // Whole degrees with degree sign, e.g. "-12°". Values beyond four digits
+    // don't fit and are shown as "--".
+    inline const char* Degrees(char (&out)[8], int degrees) {
+        if (degrees <= -1000 || degrees >= 10000) {
+            out[0] = out[1] = '-';
+            out[2] = '\0';
+            return out;
+        }
+        char* pos = AppendInt(out, degrees);
+        static const char degreeSign[] = "°"; // Two bytes in UTF-8
+        for (const char* c = degreeSign; *c != '\0'; ++c) {
+            *pos++ = *c;
+        }
+        *pos = '\0';
+        return out;
+    }
+
+} // namespace TextFormat
+} // namespace Matrix
+
+#endif
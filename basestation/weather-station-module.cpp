@@ -2,17 +2,30 @@
 
 #include <curl/curl.h>
 #include <cmath>
-#include <regex>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+#include <utility>
+#include <fstream>
 #include <iostream>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "pugixml.hpp"
+#include "text-format.hpp"
 
 using namespace std;
 using namespace Matrix;
 using namespace WeatherStation;
 
-string weatherTypeString[12] = { "SUN", "PARTLY_CLOUDY", "MOSTLY_CLOUDY", "LIGHT_FLURRIES", "SNOW", "CLOUD", "LIGHT_RAIN", "RAIN", "FREEZING_RAIN", "RAIN_SNOW", "THUNDERSHOWERS", "UNKNOWN" };
+string WeatherStation::weatherTypeString[12] = { "SUN", "PARTLY_CLOUDY", "MOSTLY_CLOUDY", "LIGHT_FLURRIES", "SNOW", "CLOUD", "LIGHT_RAIN", "RAIN", "FREEZING_RAIN", "RAIN_SNOW", "THUNDERSHOWERS", "UNKNOWN" };
 
-WeatherStationModule::WeatherStationModule(rgb_matrix::RGBMatrix* m) : MatrixModule(m) {
+WeatherStationModule::WeatherStationModule(rgb_matrix::RGBMatrix* m)
+    : MatrixModule(m),
+      // Setup current temp font
+      current_temp_font_handle(FontRegistry::Acquire("../fonts/8x13_custom.bdf")),
+      current_temp_font(*current_temp_font_handle) {
     // Setup default colors
     white_color = rgb_matrix::Color(255, 255, 255);
 
@@ -42,32 +55,111 @@ WeatherStationModule::WeatherStationModule(rgb_matrix::RGBMatrix* m) : MatrixMod
     predicted_pop_color = rgb_matrix::Color(161, 161, 161);  // Grey (consider changing for visibility)
     predicted_pop_color_day = rgb_matrix::Color(255, 255, 255);
 
-    // Setup current temp font
-    const char* bdf_font_file = "../fonts/8x13_custom.bdf";
+    // Signals the scheduler when the worker published new weather data
+    data_event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (data_event_fd < 0) {
+        throw runtime_error("Couldn't create weather data eventfd");
+    }
 
-    if (bdf_font_file == NULL) {
-        std::string errMsg = std::string("Unrecognized font file\n");
-        std::cerr << errMsg.c_str();
-        throw std::invalid_argument(errMsg);
+    // Allow pointing the module at another server (e.g. a local test server)
+    const char* datamartURL = std::getenv("WEATHER_DATAMART_URL");
+    if (datamartURL != NULL) {
+        weatherCanadaDatamartURL = datamartURL;
     }
 
-    // Load font. This needs to be a filename with a bdf bitmap font.
-    if (!current_temp_font.LoadFont(bdf_font_file)) {
-        std::string errMsg =
-            std::string("Couldn't load font \'") + bdf_font_file + "\'\n";
-        std::cerr << errMsg.c_str();
-        throw std::invalid_argument(errMsg);
+    // Start with the last good response stored on disk, so there is real data
+    // to show right away. Otherwise use an empty Weather snapshot until the
+    // first fetch completes.
+    std::shared_ptr<const Weather> initial = std::make_shared<const Weather>();
+    std::string xml;
+    time_t lastModified;
+    if (LoadWeatherDataFile(xml, lastModified)) {
+        try {
+            initial = std::make_shared<const Weather>(ParseWeatherCanXMLData(xml, *initial));
+            // Only revalidate against a file that parsed
+            weatherLastModified = lastModified;
+        }
+        catch(const std::exception& e) {
+            MatrixModule::LogError(e.what());
+        }
     }
+    latest_weather.store(initial);
 
-    // Set current network time
-    SetCurrentNetworkTime();
+    // Fetch weather data in the background
+    weather_worker = std::thread(&WeatherStationModule::WeatherWorkerLoop, this);
+}
 
-    // Setup the Weather data storage struct
-    weather = Weather();
+WeatherStationModule::~WeatherStationModule() {
+    {
+        std::lock_guard<std::mutex> lock(weather_worker_mutex);
+        weather_worker_stop = true;
+    }
+    weather_worker_cv.notify_one();
+    weather_worker.join();
+
+    if (curl != NULL) {
+        curl_easy_cleanup(curl);
+    }
+    close(data_event_fd);
 }
 
 // Weather Functions
-WeatherType WeatherStationModule::extractWeatherType(int iconCode, std::string textSummary) {
+// Case insensitive search for a lower case ASCII keyword; doesn't allocate.
+static bool ContainsKeyword(const char* text, const char* keyword) {
+    const size_t keywordLength = strlen(keyword);
+    for (/**/; *text != '\0'; ++text) {
+        if (strncasecmp(text, keyword, keywordLength) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Value of the first keyword in "table" that occurs in "text", or "fallback".
+template <typename T, size_t N>
+static T MatchKeywords(const char* text, const std::pair<const char*, T> (&table)[N], T fallback) {
+    for (const std::pair<const char*, T>& entry : table) {
+        if (ContainsKeyword(text, entry.first)) {
+            return entry.second;
+        }
+    }
+    return fallback;
+}
+
+const std::pair<const char*, ForecastPeriod> WeatherStationModule::periodKeywords[3] = {
+    { "today", TODAY },
+    { "tonight", TONIGHT },
+    { "night", NIGHT },
+};
+
+ForecastPeriod WeatherStationModule::extractForecastPeriod(const char* textForecastName) {
+    return MatchKeywords(textForecastName, periodKeywords, DAY);
+}
+
+const std::pair<const char*, WeatherType> WeatherStationModule::summaryKeywords[20] = {
+    { "thunder", THUNDERSHOWERS },
+    { "freezing", FREEZING_RAIN },
+    { "ice pellets", FREEZING_RAIN },
+    { "rain and snow", RAIN_SNOW },
+    { "snow and rain", RAIN_SNOW },
+    { "rain or snow", RAIN_SNOW },
+    { "snow or rain", RAIN_SNOW },
+    { "flurries", LIGHT_FLURRIES },
+    { "snow", SNOW },
+    { "drizzle", LIGHT_RAIN },
+    { "showers", LIGHT_RAIN },
+    { "rain", RAIN },
+    { "mostly cloudy", MOSTLY_CLOUDY },
+    { "mix of sun and cloud", PARTLY_CLOUDY },
+    { "partly cloudy", PARTLY_CLOUDY },
+    { "cloudy periods", PARTLY_CLOUDY },
+    { "cloudy", CLOUD },
+    { "overcast", CLOUD },
+    { "sunny", SUN },
+    { "clear", SUN },
+};
+
+WeatherType WeatherStationModule::extractWeatherType(int iconCode, const char* textSummary) {
     WeatherType eval = UNKNOWN;
 
     if (iconCode > -1) {
@@ -120,23 +212,18 @@ WeatherType WeatherStationModule::extractWeatherType(int iconCode, std::string t
         }
     }
 
-    // TODO: If eval is still UNKNOWN then attempt to extract from textSummary.
+    // Fall back to the text summary
+    if (eval == UNKNOWN) {
+        eval = MatchKeywords(textSummary, summaryKeywords, UNKNOWN);
+    }
 
     return eval;
 }
 
 // Time functions
-void WeatherStationModule::SetCurrentNetworkTime() {
-    // current date and time on the current system
-    next_weather_update.tv_sec = time(NULL);
-    next_weather_update.tv_nsec = 0;
-    next_time.tv_sec = time(NULL);
-    next_time.tv_nsec = 0;
-}
-
 bool WeatherStationModule::IsDaytime() {
-    bool afterSunrise = (weather.sunriseHour < local_time.tm_hour || (weather.sunriseHour == local_time.tm_hour && weather.sunriseMin <= local_time.tm_min));
-    bool beforeSunset = (weather.sunsetHour > local_time.tm_hour || (weather.sunsetHour == local_time.tm_hour && weather.sunsetMin >= local_time.tm_min));
+    bool afterSunrise = (weather->sunriseHour < local_time.tm_hour || (weather->sunriseHour == local_time.tm_hour && weather->sunriseMin <= local_time.tm_min));
+    bool beforeSunset = (weather->sunsetHour > local_time.tm_hour || (weather->sunsetHour == local_time.tm_hour && weather->sunsetMin >= local_time.tm_min));
     
     return afterSunrise && beforeSunset;
 }
@@ -149,42 +236,181 @@ size_t WeatherStationModule::CurlWriteCallback(void* contents, size_t size, size
     return totalSize;
 }
 
-// Fetch the weather XML using CURL.
-std::string WeatherStationModule::FetchData(std::string& url) {
-    std::string response;
-    
-    CURL* curl = curl_easy_init();
-    if (!curl) {
-        throw runtime_error("Failed to initialize libcurl.");
-        response = "";
+// Callback function to pick the cache validators out of the response headers
+size_t WeatherStationModule::CurlHeaderCallback(char* buffer, size_t size, size_t nitems, std::string* etag) {
+    size_t totalSize = size * nitems;
+    static const char etagHeader[] = "ETag:";
+    if (totalSize > sizeof(etagHeader) - 1 && strncasecmp(buffer, etagHeader, sizeof(etagHeader) - 1) == 0) {
+        etag->assign(buffer + sizeof(etagHeader) - 1, totalSize - (sizeof(etagHeader) - 1));
+        // Trim whitespace and the trailing CRLF
+        etag->erase(0, etag->find_first_not_of(" \t"));
+        etag->erase(etag->find_last_not_of(" \t\r\n") + 1);
+    }
+    return totalSize;
+}
+
+// Called by curl during a transfer (about once a second while it waits);
+// aborts it once the module is being destroyed, so shutdown doesn't wait for
+// the timeouts of a hanging server.
+static int CurlProgressCallback(void* stop, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow) {
+    return static_cast<std::atomic<bool>*>(stop)->load() ? 1 : 0;
+}
+
+// Fetch the weather XML using CURL. The handle is kept between calls so the
+// connection can be reused. The request is conditional on the validators of
+// the last response; returns false if the server reports no change. The
+// validators of a new response are returned in "etag" and "lastModified",
+// to be taken over once the response parsed.
+bool WeatherStationModule::FetchData(const std::string& url, std::string& response, std::string& etag, time_t& lastModified) {
+    if (curl == NULL) {
+        curl = curl_easy_init();
+        if (!curl) {
+            throw runtime_error("Failed to initialize libcurl.");
+        }
     }
 
+    etag.clear();
     curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, CurlWriteCallback);
     curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, CurlHeaderCallback);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &etag);
     curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L); // Disable SSL verification (not recommended for production)
     curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
+    curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, ""); // Any compression curl supports (gzip, ...)
+    // Don't let a hanging server block the worker (and shutdown) forever
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 30L);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, 120L);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L); // Required for timeouts in threads
+    curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, CurlProgressCallback);
+    curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &weather_worker_stop);
+    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+
+    // Revalidate instead of downloading the same document again
+    curl_easy_setopt(curl, CURLOPT_FILETIME, 1L);
+    curl_easy_setopt(curl, CURLOPT_TIMECONDITION, weatherLastModified > 0 ? CURL_TIMECOND_IFMODSINCE : CURL_TIMECOND_NONE);
+    curl_easy_setopt(curl, CURLOPT_TIMEVALUE, (long)weatherLastModified);
+    struct curl_slist* headers = NULL;
+    if (!weatherETag.empty()) {
+        headers = curl_slist_append(headers, ("If-None-Match: " + weatherETag).c_str());
+    }
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
 
     CURLcode res = curl_easy_perform(curl);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, NULL);
+    curl_slist_free_all(headers);
+    if (res == CURLE_ABORTED_BY_CALLBACK) {
+        return false; // Shutting down
+    }
     if (res != CURLE_OK) {
         throw runtime_error("curl_easy_perform() failed: " + string(curl_easy_strerror(res)));
-        response = "";
     }
 
-    curl_easy_cleanup(curl);
-    return response;
+    long responseCode = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &responseCode);
+    if (responseCode == 304) {
+        return false;
+    }
+    if (responseCode != 200) {
+        throw runtime_error("Weather data request failed with HTTP status " + std::to_string(responseCode));
+    }
+
+    long fileTime = -1;
+    curl_easy_getinfo(curl, CURLINFO_FILETIME, &fileTime);
+    lastModified = fileTime > 0 ? (time_t)fileTime : time(NULL);
+    return true;
 }
 
-void WeatherStationModule::ParseWeatherCanXMLData() {
-    pugi::xml_document doc;
-    pugi::xml_parse_result result;
+// Read the last good response persisted by SaveWeatherDataFile().
+// "lastModified" is the Last-Modified time of the content.
+bool WeatherStationModule::LoadWeatherDataFile(std::string& xml, time_t& lastModified) {
+    std::ifstream file(weatherDataFile, std::ios::binary);
+    struct stat st;
+    if (!file.is_open() || stat(weatherDataFile.c_str(), &st) != 0) {
+        return false;
+    }
+    // Read straight into the buffer that gets parsed
+    xml.resize(st.st_size);
+    if (!file.read(&xml[0], xml.size())) {
+        return false;
+    }
+
+    // The file's modification time is the Last-Modified time of its content
+    lastModified = st.st_mtime;
+    return !xml.empty();
+}
+
+// Write a response to a temporary file, to be put in place by
+// SaveWeatherDataFile() once it parsed. This way a crash or a bad response
+// never replaces the last good one.
+bool WeatherStationModule::StageWeatherDataFile(const std::string& xml) {
+    const std::string tmpFile = weatherDataFile + ".tmp";
+    std::ofstream file(tmpFile, std::ios::binary | std::ios::trunc);
+    if (!file.is_open() || !file.write(xml.data(), xml.size())) {
+        MatrixModule::LogError("Couldn't write weather data to '" + tmpFile + "'");
+        return false;
+    }
+    return true;
+}
 
-    try {
-        result = doc.load_string(FetchData(weatherCanadaDatamartURL).c_str());
+void WeatherStationModule::SaveWeatherDataFile() {
+    const std::string tmpFile = weatherDataFile + ".tmp";
+    const struct timespec times[2] = { { weatherLastModified, 0 }, { weatherLastModified, 0 } };
+    utimensat(AT_FDCWD, tmpFile.c_str(), times, 0);
+    if (rename(tmpFile.c_str(), weatherDataFile.c_str()) != 0) {
+        throw runtime_error("Couldn't replace '" + weatherDataFile + "'");
     }
-    catch (const std::exception& e) {
-        MatrixModule::LogError(e.what());
+}
+
+// Parse a temperature like "-12.3" into fixed point. Empty or malformed
+// text gives an invalid Temperature.
+static Temperature ParseTemperature(const pugi::xml_text& text) {
+    Temperature temperature;
+    const char* value = text.get();
+    char* end;
+    const double degrees = strtod(value, &end);
+    if (end != value && *end == '\0' && std::fabs(degrees) < 1000) {
+        temperature.tenths = (int16_t)std::lround(degrees * 10);
+        temperature.valid = true;
     }
+    return temperature;
+}
+
+// Format a temperature for display, rounded to whole degrees.
+static void FormatTemperature(const Temperature& temperature, char (&text)[8]) {
+    if (!temperature.valid) {
+        snprintf(text, sizeof(text), "--");
+        return;
+    }
+    // Round half away from zero, like std::round()
+    const int degrees = temperature.tenths >= 0 ? (temperature.tenths + 5) / 10 : -((-temperature.tenths + 5) / 10);
+    TextFormat::Degrees(text, degrees);
+}
+
+static void ParseDay(const pugi::xml_node& period, WeatherDay& day) {
+    snprintf(day.day, sizeof(day.day), "%s", period.text().get());
+    day.dayAbbreviation[0] = toupper(day.day[0]);
+    day.dayAbbreviation[1] = day.day[0] ? toupper(day.day[1]) : '\0';
+    day.dayAbbreviation[2] = '\0';
+}
+
+static void ParsePop(const pugi::xml_text& text, WeatherDay& day) {
+    day.pop = text.as_int(-1);
+    if (day.pop >= 0 && day.pop <= 100) {
+        snprintf(day.popText, sizeof(day.popText), "%d%%", day.pop);
+    } else {
+        day.popText[0] = '\0';
+    }
+}
+
+// Returns a new Weather snapshot; data missing from this fetch is kept from "previous".
+// The XML is parsed in place, so the contents of "xml" are garbled afterwards.
+Weather WeatherStationModule::ParseWeatherCanXMLData(std::string& xml, const Weather& previous) {
+    Weather weather = previous;
+    pugi::xml_document doc;
+    // Parse the response buffer itself instead of a copy of it. The encoding
+    // is fixed so pugixml never needs a converted copy either.
+    pugi::xml_parse_result result = doc.load_buffer_inplace(&xml[0], xml.size(), pugi::parse_default, pugi::encoding_utf8);
 
     // XML Parsing Error Checking
     if (!result) {
@@ -201,17 +427,11 @@ void WeatherStationModule::ParseWeatherCanXMLData() {
 
     // Get AST date info
     pugi::xml_node dateTime = siteData.find_child_by_attribute("dateTime", "zone", "AST"); // Get AST dateTime node
-    string year = dateTime.child("year").text().empty() ? "" : dateTime.child("year").text().get();
-    string month = dateTime.child("month").text().empty() ? "" : dateTime.child("month").text().get();
-    string day = dateTime.child("day").text().empty() ? "" : dateTime.child("day").text().get();
-    string hour = dateTime.child("hour").text().empty() ? "" : dateTime.child("hour").text().get();
-    string minute = dateTime.child("minute").text().empty() ? "" : dateTime.child("minute").text().get();
-
-    weather.year = year;
-    weather.month = month;
-    weather.day = day;
-    weather.hour = hour;
-    weather.minute = minute;
+    weather.year = dateTime.child("year").text().as_int(-1);
+    weather.month = dateTime.child("month").text().as_int(-1);
+    weather.day = dateTime.child("day").text().as_int(-1);
+    weather.hour = dateTime.child("hour").text().as_int(-1);
+    weather.minute = dateTime.child("minute").text().as_int(-1);
 
     // Get AST sunrise & sunset info
     for (pugi::xml_node sunriseNode = siteData.child("riseSet").find_child_by_attribute("dateTime", "name", "sunrise"); sunriseNode; sunriseNode = sunriseNode.next_sibling("dateTime")) {
@@ -234,30 +454,32 @@ void WeatherStationModule::ParseWeatherCanXMLData() {
 
     // Get Current Conditions
     pugi::xml_node currentConditions = siteData.child("currentConditions");
-    weather.currentConditions.tempCur = currentConditions.child("temperature").text().as_string("--");
+    weather.currentConditions.tempCur = ParseTemperature(currentConditions.child("temperature").text());
+    FormatTemperature(weather.currentConditions.tempCur, weather.currentConditions.tempCurText);
     
     // TODO: The below is untested (particularly the humidex part)
     if (currentConditions.child("windChill")) { // Get windchill (if it's winter and it exists)
-        weather.currentConditions.feelsLike = currentConditions.child("windChill").text().as_string("--");
+        weather.currentConditions.feelsLike = ParseTemperature(currentConditions.child("windChill").text());
     } else if (currentConditions.child("humidex")) { // Get humidex (if it's summer and it exists)
-        weather.currentConditions.feelsLike = currentConditions.child("humidex").text().as_string("--");
+        weather.currentConditions.feelsLike = ParseTemperature(currentConditions.child("humidex").text());
     }
+    FormatTemperature(weather.currentConditions.feelsLike, weather.currentConditions.feelsLikeText);
     
 
     pugi::xml_node currentForecast = forecastGroup.child("forecast"); // The first forecast object should be Today or Tonight (depending on time of day).
-    if (std::string(currentForecast.child("period").attribute("textForecastName").value()) == std::string("Today")) {
+    if (extractForecastPeriod(currentForecast.child("period").attribute("textForecastName").value()) == TODAY) {
         // Set day text
-        weather.currentConditions.day = currentForecast.child("period").text().get();
-
-        weather.currentConditions.tempHigh = currentForecast.child("temperatures").find_child_by_attribute("temperature", "class", "high").text().as_string("--");
+        ParseDay(currentForecast.child("period"), weather.currentConditions);
 
-        weather.currentConditions.pop = currentForecast.child("abbreviatedForecast").child("pop").text().as_int(-1);
+        weather.currentConditions.tempHigh = ParseTemperature(currentForecast.child("temperatures").find_child_by_attribute("temperature", "class", "high").text());
+        FormatTemperature(weather.currentConditions.tempHigh, weather.currentConditions.tempHighText);
 
-        weather.currentConditions.textSummary = currentForecast.child("abbreviatedForecast").child("textSummary").text().get();
+        ParsePop(currentForecast.child("abbreviatedForecast").child("pop").text(), weather.currentConditions);
 
         // Extract the Type
         int iconCode = currentForecast.child("abbreviatedForecast").child("iconCode").text().as_int(-1);
-        WeatherType type = extractWeatherType(iconCode, weather.currentConditions.textSummary);
+        const char* textSummary = currentForecast.child("abbreviatedForecast").child("textSummary").text().get();
+        WeatherType type = extractWeatherType(iconCode, textSummary);
 
         weather.currentConditions.type = type;
     }
@@ -278,26 +500,63 @@ void WeatherStationModule::ParseWeatherCanXMLData() {
         // Exit if 4 have been retrieved
         if (i >= 4) { break; }
         // Ignore any Nightly/Today Forecasts
-        std::regex nightOrTodayRegex("(night)|(today)", std::regex_constants::icase);
-        if (regex_search(forecast.child("period").attribute("textForecastName").value(), nightOrTodayRegex)) { continue; }
+        if (extractForecastPeriod(forecast.child("period").attribute("textForecastName").value()) != DAY) { continue; }
 
         // Set day text
-        weather.forecast[i].day = forecast.child("period").text().get();
+        ParseDay(forecast.child("period"), weather.forecast[i]);
 
         // Set remaining info
-        weather.forecast[i].tempHigh = forecast.child("temperatures").find_child_by_attribute("temperature", "class", "high").text().as_string("--");
+        weather.forecast[i].tempHigh = ParseTemperature(forecast.child("temperatures").find_child_by_attribute("temperature", "class", "high").text());
+        FormatTemperature(weather.forecast[i].tempHigh, weather.forecast[i].tempHighText);
 
         int iconCode = forecast.child("abbreviatedForecast").child("iconCode").text().as_int(-1);
-        int pop = forecast.child("abbreviatedForecast").child("pop").text().as_int(-1);
-        string textSummary = forecast.child("abbreviatedForecast").child("textSummary").text().get();
+        const char* textSummary = forecast.child("abbreviatedForecast").child("textSummary").text().get();
         weather.forecast[i].type = extractWeatherType(iconCode, textSummary);
-        weather.forecast[i].textSummary = textSummary;
-        weather.forecast[i].pop = pop;
+        ParsePop(forecast.child("abbreviatedForecast").child("pop").text(), weather.forecast[i]);
 
         i++;
     }
 
-    return;
+    return weather;
+}
+
+// Runs on its own thread: fetches the weather every 20 minutes and publishes
+// each result as a new immutable snapshot. The render path never waits on it.
+void WeatherStationModule::WeatherWorkerLoop() {
+    std::unique_lock<std::mutex> lock(weather_worker_mutex);
+    while (!weather_worker_stop) {
+        lock.unlock();
+        try {
+            std::string xml;
+            std::string etag;
+            time_t lastModified;
+            if (FetchData(weatherCanadaDatamartURL, xml, etag, lastModified)) {
+                // Parsing garbles the buffer, so write it out beforehand
+                bool staged = StageWeatherDataFile(xml);
+                std::shared_ptr<const Weather> previous = latest_weather.load();
+                latest_weather.store(std::make_shared<const Weather>(ParseWeatherCanXMLData(xml, *previous)));
+                // Only revalidate against a response that parsed; otherwise
+                // the next fetch downloads it again
+                weatherETag = etag;
+                weatherLastModified = lastModified;
+                const uint64_t one = 1;
+                if (write(data_event_fd, &one, sizeof(one)) != sizeof(one)) {
+                    MatrixModule::LogError("Couldn't signal new weather data");
+                }
+                if (staged) {
+                    SaveWeatherDataFile();
+                }
+            }
+            // Else the server reported no change since the last fetch
+        }
+        catch(const std::exception& e) {
+            MatrixModule::LogError(e.what());
+        }
+        lock.lock();
+
+        // Wait another 20 minutes (or until the module is destroyed)
+        weather_worker_cv.wait_for(lock, std::chrono::minutes(20), [this] { return weather_worker_stop.load(); });
+    }
 }
 
 // Draw Methods
@@ -379,85 +638,48 @@ const uint8_t* WeatherStationModule::GetSmallImageByType(WeatherType type) {
 
 void WeatherStationModule::DrawSeperatorLines() {
     if (IsDaytime()) {
-        rgb_matrix::DrawLine(off_screen_canvas, 0, 9, matrix_width, 9, seperator_color_day);
-        rgb_matrix::DrawLine(off_screen_canvas, 0, 36, matrix_width, 36, seperator_color_day);
-        rgb_matrix::DrawLine(off_screen_canvas, 47, 29, 47, 33, seperator_color_day);
+        draw_list.DrawLine(0, 9, matrix_width, 9, seperator_color_day);
+        draw_list.DrawLine(0, 36, matrix_width, 36, seperator_color_day);
+        draw_list.DrawLine(47, 29, 47, 33, seperator_color_day);
     } else {
-        rgb_matrix::DrawLine(off_screen_canvas, 0, 9, matrix_width, 9, seperator_color);
-        rgb_matrix::DrawLine(off_screen_canvas, 0, 36, matrix_width, 36, seperator_color);
-        rgb_matrix::DrawLine(off_screen_canvas, 47, 29, 47, 33, seperator_color);
+        draw_list.DrawLine(0, 9, matrix_width, 9, seperator_color);
+        draw_list.DrawLine(0, 36, matrix_width, 36, seperator_color);
+        draw_list.DrawLine(47, 29, 47, 33, seperator_color);
     }
     return;
 }
 
 void WeatherStationModule::DrawCurrentDateTime() {
     // Blank out the datetime section by drawing in black pixel values
-    rgb_matrix::SetImage(off_screen_canvas, 0, 0, matrix_weather_images::datetime_erase_box,
-        matrix_weather_images::datetime_erase_box_size,
+    draw_list.FillRectangle(0, 0,
         matrix_weather_images::datetime_erase_box_width,
-        matrix_weather_images::datetime_erase_box_height, false);
+        matrix_weather_images::datetime_erase_box_height,
+        rgb_matrix::Color(0, 0, 0));
     
 
-    std::string month = std::to_string(local_time.tm_mon + 1);
-    if (month.length() < 2) {
-        month = "0" + month;
-    }
-    std::string day = std::to_string(local_time.tm_mday);
+    char monthDayStr[6];
+    TextFormat::MonthDay(monthDayStr, local_time.tm_mon + 1, local_time.tm_mday);
 
-    std::string hour = (local_time.tm_hour % 12) == 0 ? std::to_string(12) : std::to_string(local_time.tm_hour % 12); // Convert 24 hour time to 12 hour time
-    std::string minute = std::to_string(local_time.tm_min);
-    if (hour.length() < 2) {
-        hour = "0" + hour;
-    }
-    if (minute.length() < 2) {
-        minute = "0" + minute;
-    }
+    const int hour = (local_time.tm_hour % 12) == 0 ? 12 : (local_time.tm_hour % 12); // Convert 24 hour time to 12 hour time
+    char hourMinStr[6];
+    TextFormat::HourMinute(hourMinStr, hour, local_time.tm_min);
 
-    std::string monthDayStr = month + "-" + day;
-    std::string hourMinStr = hour + ":" + minute;
-
-    std::string weekday;
-    switch (local_time.tm_wday) {
-    case 0:
-        weekday = "SUN";
-        break;
-    case 1:
-        weekday = "MON";
-        break;
-    case 2:
-        weekday = "TUE";
-        break;
-    case 3:
-        weekday = "WED";
-        break;
-    case 4:
-        weekday = "THU";
-        break;
-    case 5:
-        weekday = "FRI";
-        break;
-    case 6:
-        weekday = "SAT";
-        break;
-    default:
-        weekday = "---";
-        break;
-    }
+    const char* weekday = TextFormat::Weekday(local_time.tm_wday);
 
     if (IsDaytime()) {
-        rgb_matrix::DrawText(
-            off_screen_canvas, font, 2, 2 + font.baseline(), date_color_day, NULL, monthDayStr.c_str(), letter_spacing);
-        rgb_matrix::DrawText(
-            off_screen_canvas, font, 25, 2 + font.baseline(), clock_color, NULL, hourMinStr.c_str(), letter_spacing);
-        rgb_matrix::DrawText(
-            off_screen_canvas, font, 51, 2 + font.baseline(), current_weekday_color_day, NULL, weekday.c_str(), letter_spacing);
+        draw_list.DrawText(
+            font, 2, 2 + font.baseline(), date_color_day, NULL, monthDayStr, letter_spacing);
+        draw_list.DrawText(
+            font, 25, 2 + font.baseline(), clock_color, NULL, hourMinStr, letter_spacing);
+        draw_list.DrawText(
+            font, 51, 2 + font.baseline(), current_weekday_color_day, NULL, weekday, letter_spacing);
     } else {
-        rgb_matrix::DrawText(
-            off_screen_canvas, font, 2, 2 + font.baseline(), date_color, NULL, monthDayStr.c_str(), letter_spacing);
-        rgb_matrix::DrawText(
-            off_screen_canvas, font, 25, 2 + font.baseline(), clock_color, NULL, hourMinStr.c_str(), letter_spacing);
-        rgb_matrix::DrawText(
-            off_screen_canvas, font, 51, 2 + font.baseline(), current_weekday_color, NULL, weekday.c_str(), letter_spacing);
+        draw_list.DrawText(
+            font, 2, 2 + font.baseline(), date_color, NULL, monthDayStr, letter_spacing);
+        draw_list.DrawText(
+            font, 25, 2 + font.baseline(), clock_color, NULL, hourMinStr, letter_spacing);
+        draw_list.DrawText(
+            font, 51, 2 + font.baseline(), current_weekday_color, NULL, weekday, letter_spacing);
     }
     
 
@@ -466,58 +688,54 @@ void WeatherStationModule::DrawCurrentDateTime() {
 
 void WeatherStationModule::DrawCurrentDayWeatherData() {
     // Draw weather icon
-    rgb_matrix::SetImage(off_screen_canvas, 4, 13,
-        GetLargeImageByType(weather.currentConditions.type),
+    draw_list.SetImage(4, 13,
+        GetLargeImageByType(weather->currentConditions.type),
         matrix_weather_images::large_weather_icon_size,
         matrix_weather_images::large_weather_icon_width,
         matrix_weather_images::large_weather_icon_height, false);
 
+    const WeatherDay& today = weather->currentConditions;
+
     // Draw current temp
-    if (weather.currentConditions.tempCur != std::string("--")) {
-        string currentTemp = std::to_string((int)std::round(stod(weather.currentConditions.tempCur))); // Round the value first
-        currentTemp += "°";
-        if (currentTemp.length() <= 3) { // If there are 2 characters or less (degree character takes 2 bytes)
-            rgb_matrix::DrawText(
-                off_screen_canvas, current_temp_font, 44, 13 + current_temp_font.baseline(), temp_cur_color, NULL, currentTemp.c_str(), letter_spacing);
+    if (today.tempCur.valid) {
+        if (strlen(today.tempCurText) <= 3) { // If there are 2 characters or less (degree character takes 2 bytes)
+            draw_list.DrawText(
+                current_temp_font, 44, 13 + current_temp_font.baseline(), temp_cur_color, NULL, today.tempCurText, letter_spacing);
         } else {
-            rgb_matrix::DrawText(
-                off_screen_canvas, current_temp_font, 40, 13 + current_temp_font.baseline(), temp_cur_color, NULL, currentTemp.c_str(), letter_spacing);
+            draw_list.DrawText(
+                current_temp_font, 40, 13 + current_temp_font.baseline(), temp_cur_color, NULL, today.tempCurText, letter_spacing);
         }
     } else {
-        rgb_matrix::DrawText(
-            off_screen_canvas, current_temp_font, 44, 13 + current_temp_font.baseline(), temp_cur_color, NULL, weather.currentConditions.tempCur.c_str(), letter_spacing);
+        draw_list.DrawText(
+            current_temp_font, 44, 13 + current_temp_font.baseline(), temp_cur_color, NULL, today.tempCurText, letter_spacing);
     }
 
     // Draw high temp
-    if (weather.currentConditions.tempHigh != std::string("--")) {
-        string highTemp = std::to_string((int)std::round(stod(weather.currentConditions.tempHigh))); // Round the value first
-        highTemp += "°";
-        if (highTemp.length() <= 3) { // If there are 2 characters or less (degree character takes 2 bytes)
-            rgb_matrix::DrawText(
-                off_screen_canvas, font, 40, 29 + font.baseline(), temp_high_color, NULL, highTemp.c_str(), letter_spacing);
+    if (today.tempHigh.valid) {
+        if (strlen(today.tempHighText) <= 3) { // If there are 2 characters or less (degree character takes 2 bytes)
+            draw_list.DrawText(
+                font, 40, 29 + font.baseline(), temp_high_color, NULL, today.tempHighText, letter_spacing);
         } else {
-            rgb_matrix::DrawText(
-                off_screen_canvas, font, 36, 29 + font.baseline(), temp_high_color, NULL, highTemp.c_str(), letter_spacing);
+            draw_list.DrawText(
+                font, 36, 29 + font.baseline(), temp_high_color, NULL, today.tempHighText, letter_spacing);
         }
     } else {
-        rgb_matrix::DrawText(
-            off_screen_canvas, font, 38, 29 + font.baseline(), temp_high_color, NULL, weather.currentConditions.tempHigh.c_str(), letter_spacing);
+        draw_list.DrawText(
+            font, 38, 29 + font.baseline(), temp_high_color, NULL, today.tempHighText, letter_spacing);
     }
 
     // Draw feelsLike (change colour depending if it's humidex or windchill)
-    if (weather.currentConditions.feelsLike != std::string("--") && weather.currentConditions.tempCur != std::string("--")) {
-        string feelsLike = std::to_string((int)std::round(stod(weather.currentConditions.feelsLike)));
-        feelsLike += "°";
-        if (stod(weather.currentConditions.feelsLike) > stod(weather.currentConditions.tempCur)) {
-            rgb_matrix::DrawText(
-                off_screen_canvas, font, 50, 29 + font.baseline(), humidex_color, NULL, feelsLike.c_str(), letter_spacing);
+    if (today.feelsLike.valid && today.tempCur.valid) {
+        if (today.feelsLike.tenths > today.tempCur.tenths) {
+            draw_list.DrawText(
+                font, 50, 29 + font.baseline(), humidex_color, NULL, today.feelsLikeText, letter_spacing);
         } else {
-            rgb_matrix::DrawText(
-                off_screen_canvas, font, 50, 29 + font.baseline(), windchill_color, NULL, feelsLike.c_str(), letter_spacing);
+            draw_list.DrawText(
+                font, 50, 29 + font.baseline(), windchill_color, NULL, today.feelsLikeText, letter_spacing);
         }
     } else {
-        rgb_matrix::DrawText(
-            off_screen_canvas, font, 50, 29 + font.baseline(), white_color, NULL, weather.currentConditions.feelsLike.c_str(), letter_spacing);
+        draw_list.DrawText(
+            font, 50, 29 + font.baseline(), white_color, NULL, today.feelsLikeText, letter_spacing);
     }
 
     return;
@@ -526,55 +744,53 @@ void WeatherStationModule::DrawCurrentDayWeatherData() {
 void WeatherStationModule::DrawPredictedDailyForecastData() {
     int offset = 17;
     for (size_t i = 0; i < 4; i++) {
+        const WeatherDay& day = weather->forecast[i];
+
         // Draw weekday text
-        std::string weekday = weather.forecast[i].day.substr(0, 2);
-        std::transform(weekday.begin(), weekday.end(), weekday.begin(), ::toupper);
         if (IsDaytime()) {
-            rgb_matrix::DrawText(
-                off_screen_canvas, font, 3 + (offset*i), 38 + font.baseline(), future_weekday_color_day, NULL, weekday.c_str(), letter_spacing);
+            draw_list.DrawText(
+                font, 3 + (offset*i), 38 + font.baseline(), future_weekday_color_day, NULL, day.dayAbbreviation, letter_spacing);
         } else {
-            rgb_matrix::DrawText(
-                off_screen_canvas, font, 3 + (offset*i), 38 + font.baseline(), future_weekday_color, NULL, weekday.c_str(), letter_spacing);
+            draw_list.DrawText(
+                font, 3 + (offset*i), 38 + font.baseline(), future_weekday_color, NULL, day.dayAbbreviation, letter_spacing);
         }
         
         
         // Draw weather icon
-        rgb_matrix::SetImage(off_screen_canvas, 3 + (offset*i), 44,
-            GetSmallImageByType(weather.forecast[i].type),
+        draw_list.SetImage(3 + (offset*i), 44,
+            GetSmallImageByType(day.type),
             matrix_weather_images::small_weather_icon_size,
             matrix_weather_images::small_weather_icon_width,
             matrix_weather_images::small_weather_icon_height, false);
 
         // Draw temp high
-        string highTemp = std::to_string((int)std::round(stod(weather.forecast[i].tempHigh))); // Round the value first
-        highTemp += "°";
+        const bool shortHighTemp = strlen(day.tempHighText) <= 3; // If there are 2 characters or less (degree character takes 2 bytes)
         if (IsDaytime()) {
-            if(highTemp.length() <= 3) { // If there are 2 characters or less (degree character takes 2 bytes)
-                rgb_matrix::DrawText(
-                    off_screen_canvas, font, 5 + (offset*i), 53 + font.baseline(), temp_predicted_high_color_day, NULL, highTemp.c_str(), letter_spacing);
+            if (shortHighTemp) {
+                draw_list.DrawText(
+                    font, 5 + (offset*i), 53 + font.baseline(), temp_predicted_high_color_day, NULL, day.tempHighText, letter_spacing);
             } else {
-                rgb_matrix::DrawText(
-                    off_screen_canvas, font, 3 + (offset*i), 53 + font.baseline(), temp_predicted_high_color_day, NULL, highTemp.c_str(), letter_spacing);
+                draw_list.DrawText(
+                    font, 3 + (offset*i), 53 + font.baseline(), temp_predicted_high_color_day, NULL, day.tempHighText, letter_spacing);
             }
         } else {
-            if(highTemp.length() <= 3) { // If there are 2 characters or less (degree character takes 2 bytes)
-                rgb_matrix::DrawText(
-                    off_screen_canvas, font, 5 + (offset*i), 53 + font.baseline(), temp_predicted_high_color, NULL, highTemp.c_str(), letter_spacing);
+            if (shortHighTemp) {
+                draw_list.DrawText(
+                    font, 5 + (offset*i), 53 + font.baseline(), temp_predicted_high_color, NULL, day.tempHighText, letter_spacing);
             } else {
-                rgb_matrix::DrawText(
-                    off_screen_canvas, font, 3 + (offset*i), 53 + font.baseline(), temp_predicted_high_color, NULL, highTemp.c_str(), letter_spacing);
+                draw_list.DrawText(
+                    font, 3 + (offset*i), 53 + font.baseline(), temp_predicted_high_color, NULL, day.tempHighText, letter_spacing);
             }
         }
 
         // Draw POP (if it exists)
-        if(weather.forecast[i].pop > 0) {
-            string pop = std::to_string(weather.forecast[i].pop);
+        if(day.pop > 0) {
             if (IsDaytime()) {
-                rgb_matrix::DrawText(
-                    off_screen_canvas, font, 2 + (offset*i), 59 + font.baseline(), predicted_pop_color_day, NULL, string(pop + "%").c_str(), letter_spacing);
+                draw_list.DrawText(
+                    font, 2 + (offset*i), 59 + font.baseline(), predicted_pop_color_day, NULL, day.popText, letter_spacing);
             } else {
-                rgb_matrix::DrawText(
-                    off_screen_canvas, font, 2 + (offset*i), 59 + font.baseline(), predicted_pop_color, NULL, string(pop + "%").c_str(), letter_spacing);
+                draw_list.DrawText(
+                    font, 2 + (offset*i), 59 + font.baseline(), predicted_pop_color, NULL, day.popText, letter_spacing);
             }
         }
     }
@@ -586,44 +802,44 @@ void WeatherStationModule::DrawWeatherStationCanvas(bool dateTimeOnly) {
     if (dateTimeOnly) {
         DrawCurrentDateTime(); // Update the datetime only
     } else {
-        off_screen_canvas->Fill(0, 0, 0);
+        drawnDaytime = IsDaytime();
+        draw_list.Fill(rgb_matrix::Color(0, 0, 0));
         DrawSeperatorLines();
         DrawCurrentDateTime();
         DrawCurrentDayWeatherData();
         DrawPredictedDailyForecastData();
     }
+
+    // Everything above was only recorded; draw it all in one go
+    draw_list.Flush(off_screen_canvas);
     return;
 }
 
-rgb_matrix::FrameCanvas* WeatherStationModule::Update() {
-    // Set readable local_time from next_time.tv_sec
-    next_time.tv_sec = time(NULL);
-    next_time.tv_nsec = 0;
-    localtime_r(&next_time.tv_sec, &local_time);
+Deadline WeatherStationModule::NextDeadline(const struct timespec& now) {
+    // Show new weather data right away
+    if (latest_weather.load() != weather) {
+        return { now, WakeReason::DATA };
+    }
+    // Otherwise only the clock changes, and that shows minutes
+    return { { (now.tv_sec / 60 + 1) * 60, 0 }, WakeReason::TICK };
+}
 
-    // If 20 minutes have passed, re-fetch & redraw weather data
-    clock_gettime(CLOCK_REALTIME, &current_time);
-    if (current_time.tv_sec >= next_weather_update.tv_sec) {
-        next_weather_update.tv_sec = current_time.tv_sec + 60*20; // Wait another 20 minutes from now
-        try {
-            ParseWeatherCanXMLData();
-        }
-        catch(const std::exception& e) {
-            MatrixModule::LogError(e.what());
-        }
+rgb_matrix::FrameCanvas* WeatherStationModule::Render(const Deadline& deadline) {
+    // Set readable local_time from the time the frame is shown
+    localtime_r(&deadline.time.tv_sec, &local_time);
+
+    // If the worker published new weather data, redraw everything
+    std::shared_ptr<const Weather> latest = latest_weather.load();
+    if (deadline.reason != WakeReason::TICK && latest != weather) {
+        weather = latest;
+        DrawWeatherStationCanvas(false);
+    } else if (weather && IsDaytime() != drawnDaytime) {
+        // Sunrise or sunset: everything drawn in day or night colors changes
         DrawWeatherStationCanvas(false);
     } else {
         // Else redraw only the time
-        // Draw the analog clock with the digital clock in the center.
         DrawWeatherStationCanvas(true);
     }
 
-    // Wait to update time.
-    clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &next_time, NULL);
-
-    // Update the time seconds (to the next whole 15 second interval)
-    //next_time.tv_sec = (current_time.tv_sec / 15 + 1) * 15;
-    next_time.tv_sec = current_time.tv_sec + 1;
-
     return off_screen_canvas;
 }
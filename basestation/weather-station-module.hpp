@@ -3,10 +3,20 @@
 
 #include "matrix-module.hpp"
 
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <utility>
 
 #include "weather-module-images.hpp"
 
+typedef void CURL;
+
 using namespace Matrix;
 
 namespace WeatherStation {
@@ -28,27 +38,47 @@ namespace WeatherStation {
 
     extern std::string weatherTypeString[12];
 
+    // Kind of period a forecast is for, from its textForecastName
+    typedef enum {
+        TODAY,          // "Today"
+        TONIGHT,        // "Tonight"
+        NIGHT,          // e.g. "Sunday night"
+        DAY             // e.g. "Sunday"
+    } ForecastPeriod;
+
+    // Temperature in fixed point: tenths of a degree Celsius
     typedef struct {
-        std::string day = "";
+        int16_t tenths = 0;
+        bool valid = false; // False if not available or malformed
+    } Temperature;
 
-        std::string tempCur = "--"; // Only available for current 
-        std::string feelsLike = "--"; // Only available for current conditions
+    // All text is formatted once when parsing, so drawing doesn't need to.
+    typedef struct {
+        char day[16] = "";            // e.g. "Saturday"
+        char dayAbbreviation[3] = ""; // e.g. "SA"
+
+        Temperature tempCur;   // Only available for current conditions
+        Temperature feelsLike; // Only available for current conditions
+        Temperature tempHigh;
 
-        std::string tempHigh = "--";
+        // Rounded to whole degrees, e.g. "-12°"; "--" if not available
+        char tempCurText[8] = "--";
+        char feelsLikeText[8] = "--";
+        char tempHighText[8] = "--";
 
         // Abbreviated
         WeatherType type = UNKNOWN; // Default to UNKNOWN
-        std::string textSummary = "";
         int pop = -1; // Percentage of Precipitation. May be empty, so set to -1.
+        char popText[8] = ""; // e.g. "30%"
     } WeatherDay;
 
     typedef struct {
         // Date and Time of the Weather data
-        std::string year = "--";
-        std::string month = "--";
-        std::string day = "--";
-        std::string hour = "--";
-        std::string minute = "--";
+        int year = -1;
+        int month = -1;
+        int day = -1;
+        int hour = -1;
+        int minute = -1;
 
         int sunriseHour = -1;
         int sunriseMin = -1;
@@ -84,16 +114,18 @@ namespace WeatherStation {
         rgb_matrix::Color predicted_pop_color;  // Grey (consider changing for visibility)
         rgb_matrix::Color predicted_pop_color_day;
 
-        rgb_matrix::Font current_temp_font;
+        std::shared_ptr<const rgb_matrix::Font> current_temp_font_handle;
+        const rgb_matrix::Font& current_temp_font;
         // Everything else can use the default font
 
+        // The draw methods record into this; DrawWeatherStationCanvas()
+        // flushes it onto off_screen_canvas.
+        rgb_matrix::DrawList draw_list;
+
         // Time Variables
-        struct timespec current_time;
-        // For clock
-        struct timespec next_time;
         struct tm local_time;
-        // For weather update timing
-        struct timespec next_weather_update;
+        // Whether the last full redraw used the day colors
+        bool drawnDaytime = false;
 
         // TODO: There is another server that serves the same information. If this one returns an error, try again with the other one.
         std::string weatherCanadaStationCode = "s0000439";
@@ -101,20 +133,39 @@ namespace WeatherStation {
         std::string weatherDataFile = "weatherData.xml";
         std::string weatherArchivedDataFile = "weatherDataArchive.xml";
 
-        // Hold the weather data
-        Weather weather;
+        // Persistent connection and the cache validators of the last response
+        // (only used by the fetch worker)
+        CURL* curl = NULL;
+        std::string weatherETag;
+        time_t weatherLastModified = 0;
+
+        // Latest weather data, published by the fetch worker as immutable snapshots
+        std::atomic<std::shared_ptr<const Weather>> latest_weather;
+        // The snapshot currently drawn (render path only)
+        std::shared_ptr<const Weather> weather;
+
+        // Background fetch worker
+        std::thread weather_worker;
+        std::mutex weather_worker_mutex;
+        std::condition_variable weather_worker_cv;
+        // Also polled by curl without the mutex, to abort a running transfer
+        std::atomic<bool> weather_worker_stop = false;
+        int data_event_fd;
+        void WeatherWorkerLoop();
 
         // Weather Fetch Functions
         static size_t CurlWriteCallback(void* contents, size_t size, size_t nmemb, std::string* output);
-        std::string FetchData(std::string& url);
+        static size_t CurlHeaderCallback(char* buffer, size_t size, size_t nitems, std::string* etag);
+        bool FetchData(const std::string& url, std::string& response, std::string& etag, time_t& lastModified);
+        bool LoadWeatherDataFile(std::string& xml, time_t& lastModified);
+        bool StageWeatherDataFile(const std::string& xml);
+        void SaveWeatherDataFile();
         WeatherDay FetchArchivedForecast(); // TODO: Implement this
 
         // Weather Functions
-        WeatherType extractWeatherType(int iconCode, std::string textSummary);
-        void ParseWeatherCanXMLData();
+        Weather ParseWeatherCanXMLData(std::string& xml, const Weather& previous);
 
         // Time Functions
-        void SetCurrentNetworkTime();
         bool IsDaytime();
 
         // Draw Methods
@@ -131,11 +182,25 @@ namespace WeatherStation {
 
         void DrawWeatherStationCanvas(bool dateTimeOnly); // Main draw function
 
-        // Main Method
-        rgb_matrix::FrameCanvas* Update();
+        // Main Methods: redraw on new data, otherwise every minute
+        Deadline NextDeadline(const struct timespec& now);
+        rgb_matrix::FrameCanvas* Render(const Deadline& deadline);
+        int EventFd() { return data_event_fd; }
 
     public:
         WeatherStationModule(rgb_matrix::RGBMatrix* m);
+        ~WeatherStationModule();
+
+        // Classify a forecast by its textForecastName, and by its icon code
+        // or else its text summary. Neither allocates.
+        static ForecastPeriod extractForecastPeriod(const char* textForecastName);
+        static WeatherType extractWeatherType(int iconCode, const char* textSummary);
+
+        // The keywords looked for in the text, case insensitively. The first
+        // one found decides, so more specific keywords come before the words
+        // they contain: "tonight" before "night", "freezing" before "rain".
+        static const std::pair<const char*, ForecastPeriod> periodKeywords[3];
+        static const std::pair<const char*, WeatherType> summaryKeywords[20];
     };
 
 } // namespace WeatherStation 
@@ -18,6 +18,7 @@
 #include <sys/types.h>
 
 #include <string>
+#include <vector>
 
 namespace rgb_matrix {
 class FrameCanvas;
@@ -39,6 +40,13 @@ public:
   // Write bytes from buffer. Similar to Posix behavior that allows short
   // writes.
   virtual ssize_t Append(const void *buf, size_t count) = 0;
+
+  // Optional random access, needed to make use of a stream index.
+  // Move to absolute "offset". Returns 'false' if not supported.
+  virtual bool Seek(size_t offset) { return false; }
+
+  // Total size of the stream, or -1 if not known.
+  virtual ssize_t Size() { return -1; }
 };
 
 class FileStreamIO : public StreamIO {
@@ -49,6 +57,8 @@ public:
   void Rewind() final;
   ssize_t Read(void *buf, size_t count) final;
   ssize_t Append(const void *buf, size_t count) final;
+  bool Seek(size_t offset) final;
+  ssize_t Size() final;
 
 private:
   const int fd_;
@@ -60,6 +70,8 @@ public:
   void Rewind() final;
   ssize_t Read(void *buf, size_t count) final;
   ssize_t Append(const void *buf, size_t count) final;
+  bool Seek(size_t offset) final;
+  ssize_t Size() final { return buffer_.size(); }
 
 private:
   std::string buffer_;  // super simplistic.
@@ -81,26 +93,59 @@ public:
   // No append, this is purely read-only.
   ssize_t Append(const void *buf, size_t count) final { return -1; }
 
+  bool Seek(size_t offset) final;
+  ssize_t Size() final { return IsInitialized() ? end_ - buffer_ : -1; }
+
 private:
   char *buffer_;
   char *end_;
   char *pos_;
 };
 
+// Entry of the optional frame index at the end of a stream.
+struct StreamIndexEntry {
+  uint64_t offset : 63;        // Position of the frame in the stream.
+  uint64_t is_key_frame : 1;
+  uint64_t start_time_us;      // Sum of the hold times of all frames before.
+};
+
+// Frames are stored as key frames with the complete content. With a
+// "keyframe_interval" larger than 1, frames in between are stored as the
+// XOR-difference to the previous frame of the words that changed, if that is
+// smaller. Such a stream can only be read by this or a later version of the
+// library, and places restrictions on the FrameCanvases it is read into
+// (see StreamReader::GetNext()).
 class StreamWriter {
 public:
-  // Does not take ownership of StreamIO
-  StreamWriter(StreamIO *io);
+  // Does not take ownership of StreamIO.
+  // At least every "keyframe_interval" frames, a key frame is written; the
+  // default of 1 writes only key frames.
+  StreamWriter(StreamIO *io, int keyframe_interval = 1);
 
   // Stream out given canvas at the given time. "hold_time_us" indicates
   // for how long this frame is to be shown in microseconds.
   bool Stream(const FrameCanvas &frame, uint32_t hold_time_us);
 
+  // Append an index of all frames streamed, which allows a StreamReader to
+  // seek and to know the total duration. Call once after the last frame.
+  bool WriteIndex();
+
 private:
   void WriteFileHeader(const FrameCanvas &frame, size_t len);
+  // Fill delta_ with the difference of "data" to previous_. Returns false
+  // if that is not smaller than the frame itself.
+  bool EncodeDelta(const char *data, size_t len, uint64_t *changed_rows);
 
   StreamIO *const io_;
+  const int keyframe_interval_;
   bool header_written_;
+  size_t row_size_;           // Bytes per double-row.
+  int frames_since_keyframe_;
+  std::string previous_;      // The last frame written.
+  std::string delta_;
+  uint64_t bytes_written_;
+  uint64_t duration_us_;      // Sum of all hold times so far.
+  std::vector<StreamIndexEntry> index_;
 };
 
 class StreamReader {
@@ -114,20 +159,64 @@ public:
 
   // Get next frame and its timestamp. Returns 'false' if there is an error
   // or end of stream reached..
+  //
+  // Frames stored as a difference (see StreamWriter) are applied in place on
+  // top of the previous frame. If "frame" is not the FrameCanvas the previous
+  // frame was read into, only the double-rows that changed since it last was
+  // are copied over first. So for such streams, all FrameCanvases passed need
+  // to come from the same RGBMatrix and are not to be modified between calls:
+  // anything drawn on top of a frame would show up in the following ones.
   bool GetNext(FrameCanvas *frame, uint32_t* hold_time_us);
 
+  // If the stream ends with an index (see StreamWriter::WriteIndex()) and
+  // the StreamIO supports Seek(), it is loaded on construction and allows
+  // to know the length and to seek without reading the whole stream.
+  bool HasIndex() const { return !index_.empty(); }
+  size_t FrameCount() const { return index_.size(); }
+  uint64_t DurationUs() const { return duration_us_; }
+
+  // Let the next GetNext() return the given frame number, counting from 0,
+  // or the frame that is shown at "time_us" from the beginning. Returns
+  // 'false' if there is no index or it is past the end. Decoding starts at
+  // the key frame before, so the next GetNext() reads up to the key frame
+  // interval of frames.
+  bool SeekToFrame(size_t frame_number);
+  bool SeekToTime(uint64_t time_us);
+
 private:
   enum State {
     STREAM_AT_BEGIN,
     STREAM_READING,
+    STREAM_AT_END,
     STREAM_ERROR,
   };
+  // Returns whether the stream was moved looking for the index.
+  bool LoadIndex();
   bool ReadFileHeader(const FrameCanvas &frame);
+  bool ReadFrame(FrameCanvas *frame, uint32_t* hold_time_us);
+  bool ApplyDelta(FrameCanvas *frame, size_t size);
+  // Remember that "frame" now has the current frame, and which double-rows
+  // are outdated in the other FrameCanvases.
+  void FrameRead(const FrameCanvas *frame, uint64_t changed_rows);
 
   StreamIO *io_;
   size_t frame_buf_size_;
+  uint32_t version_;
   State state_;
 
-  char *header_frame_buffer_;
+  char *frame_buffer_;
+
+  // FrameCanvases frames were read into, and the double-rows changed since.
+  struct CanvasState {
+    const FrameCanvas *canvas;
+    uint64_t outdated_rows;
+  };
+  std::vector<CanvasState> canvases_;
+  const FrameCanvas *last_frame_;  // Has the last frame read.
+
+  std::vector<StreamIndexEntry> index_;
+  std::vector<size_t> key_frames_;  // Frame numbers of the key frames.
+  uint64_t duration_us_;
+  size_t seek_frame_;               // Frame to seek to before the next read.
 };
 }
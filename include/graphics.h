@@ -13,8 +13,15 @@
 #include <stddef.h>
 
 #include <map>
+#include <vector>
 
 namespace rgb_matrix {
+class DrawList;
+class FrameCanvas;
+namespace internal {
+class Framebuffer;
+}
+
 struct Color {
   Color() : r(0), g(0), b(0) {}
   Color(uint8_t rr, uint8_t gg, uint8_t bb) : r(rr), g(gg), b(bb) {}
@@ -23,6 +30,20 @@ struct Color {
   uint8_t b;
 };
 
+// Per-channel color calibration of a panel, applied before brightness and
+// luminance correction: a channel value c (0..255) is shown as
+//   white * (c / 255) ^ gamma
+// A "white" below 255 tones down a channel that is too strong (white
+// balance), a "gamma" other than 1 bends its curve. The default leaves the
+// colors unchanged. Index 0, 1, 2 are red, green, blue.
+struct ColorCalibration {
+  ColorCalibration() {
+    for (int i = 0; i < 3; ++i) { white[i] = 255; gamma[i] = 1.0f; }
+  }
+  uint8_t white[3];
+  float gamma[3];
+};
+
 // Font loading bdf files. If this ever becomes more types, just make virtual
 // base class.
 class Font {
@@ -31,8 +52,17 @@ public:
   Font();
   ~Font();
 
+  // Load font from a BDF file or from a binary font file as written by
+  // WriteBinaryFont(); the format is recognized automatically. Binary fonts
+  // are mmap()ed and usable right away without parsing.
   bool LoadFont(const char *path);
 
+  // Write this font in a compact binary format that loads much faster than
+  // BDF. Typically used to convert a BDF font once. The format is in host
+  // byte order, so not portable between machines of different endianness.
+  // Returns 'false' if writing failed.
+  bool WriteBinaryFont(const char *path) const;
+
   // Return height of font in pixels. Returns -1 if font has not been loaded.
   int height() const { return font_height_; }
 
@@ -59,6 +89,11 @@ public:
   int DrawGlyph(Canvas *c, int x, int y, const Color &color,
                 uint32_t unicode_codepoint) const;
 
+  // Same as above, but recorded in "list" to be drawn later.
+  int DrawGlyph(DrawList *list, int x, int y,
+                const Color &color, const Color *background_color,
+                uint32_t unicode_codepoint) const;
+
   // Create a new font derived from this font, which represents an outline
   // of the original font, essentially pixels tracing around the original
   // letter.
@@ -73,11 +108,24 @@ private:
   struct Glyph;
   typedef std::map<uint32_t, Glyph*> CodepointGlyphMap;
 
+  bool LoadBinaryFont(const char *path);
+
+  // Takes ownership of glyph, replacing a possibly existing one.
+  void AddGlyph(uint32_t codepoint, Glyph *glyph);
   const Glyph *FindGlyph(uint32_t codepoint) const;
 
   int font_height_;
   int base_line_;
   CodepointGlyphMap glyphs_;
+
+  // Direct lookup for the Basic Multilingual Plane: pages of 256 glyphs,
+  // only allocated for pages that contain any. Glyphs owned by glyphs_.
+  static constexpr int kGlyphPages = 256;
+  Glyph **glyph_pages_[kGlyphPages];
+
+  // Binary font file the glyph spans point into, if loaded from one.
+  void *mapped_file_;
+  size_t mapped_size_;
 };
 
 // -- Some utility functions.
@@ -139,6 +187,92 @@ void DrawCircle(Canvas *c, int x, int y, int radius, const Color &color);
 // Draw a line from "x0", "y0" to "x1", "y1" and with "color"
 void DrawLine(Canvas *c, int x0, int y0, int x1, int y1, const Color &color);
 
+// Same, but "thickness" pixels wide: every pixel of the line is drawn as a
+// "thickness" x "thickness" square extending to the right and down.
+void DrawLine(Canvas *c, int x0, int y0, int x1, int y1, int thickness,
+              const Color &color);
+
+// Fill the rectangle of "width" x "height" pixels at "x", "y" with "color"
+void FillRectangle(Canvas *c, int x, int y, int width, int height,
+                   const Color &color);
+
+// On a FrameCanvas, the functions above write straight to the bitplanes,
+// mapping the color only once per call.
+
+// A list of drawing operations, recorded to be drawn onto a FrameCanvas in
+// one go with Flush(). That maps each distinct color only once, and writes
+// every pixel only once, with what was recorded last for it: overlapping
+// erase boxes, text backgrounds and anything drawn over cost no more than
+// what ends up visible. Pixels are written in row order. Rectangles
+// recorded first, without a Fill(), are the exception: they are filled as
+// a whole underneath the rest, which is much faster than row by row.
+//
+// The list keeps its memory from frame to frame, so after the first few
+// frames recording doesn't allocate anymore.
+class DrawList {
+public:
+  DrawList();
+
+  // Forget everything recorded so far.
+  void Clear();
+
+  // Same as the functions of the same name above and Canvas::Fill(), but
+  // recorded. Fill() makes everything recorded before irrelevant and is
+  // done with a fast full-canvas fill. SetImage() doesn't copy the image,
+  // so "image_buffer" needs to stay valid until Flush().
+  void Fill(const Color &color);
+  void FillRectangle(int x, int y, int width, int height, const Color &color);
+  void DrawLine(int x0, int y0, int x1, int y1, const Color &color);
+  void DrawLine(int x0, int y0, int x1, int y1, int thickness,
+                const Color &color);
+  void DrawCircle(int x, int y, int radius, const Color &color);
+  bool SetImage(int canvas_offset_x, int canvas_offset_y,
+                const uint8_t *image_buffer, size_t buffer_size_bytes,
+                int image_width, int image_height,
+                bool is_bgr);
+  int DrawText(const Font &font, int x, int y,
+               const Color &color, const Color *background_color,
+               const char *utf8_text, int kerning_offset = 0);
+
+  // Draw everything recorded onto "c", then clear the list.
+  void Flush(FrameCanvas *c);
+
+private:
+  friend class internal::Framebuffer;
+
+  // A horizontal run of pixels, either in one color or from an image row.
+  struct Span {
+    int16_t x, y;
+    int16_t length;
+    uint16_t color;          // Index into colors_, if not an image row.
+    const uint8_t *pixels;   // Image row with 3 bytes per pixel, or NULL.
+    bool is_bgr;
+  };
+
+  // A rectangle in one color.
+  struct Rect {
+    int x, y, width, height;
+    uint16_t color;          // Index into colors_.
+  };
+
+  void AddSpan(int x, int y, int length, uint16_t color,
+               const uint8_t *pixels, bool is_bgr);
+  uint16_t ColorIndex(const Color &color);
+
+  bool has_fill_;
+  Color fill_color_;
+  std::vector<Color> colors_;
+  uint16_t last_color_;            // Index of the color used last.
+  std::vector<Rect> base_rects_;   // Recorded before everything else.
+  std::vector<Span> spans_;        // In recording order; later ones on top.
+
+  // Used by Flush(): span indices sorted by row, where each row ends in
+  // there, and one bit per column for pixels already drawn.
+  std::vector<uint32_t> by_row_;
+  std::vector<uint32_t> row_end_;
+  std::vector<uint64_t> covered_;
+};
+
 }  // namespace rgb_matrix
 
 #endif  // RPI_GRAPHICS_H
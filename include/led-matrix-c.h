@@ -158,6 +158,12 @@ struct RGBLedMatrixOptions {
    * processes when waiting and renders single core boards more responsive.
    */
   bool disable_busy_waiting;     /* Corresponding flag: --led-busy-waiting */
+
+  /* Hand frames to the refresh thread through a lock-free triple buffer.
+   * Then led_matrix_publish_frame() hands over frames without waiting for
+   * vsync.
+   */
+  bool triple_buffering;         /* Corresponding flag: --led-triple-buffer */
 };
 
 /**
@@ -200,6 +206,26 @@ struct RGBLedRuntimeOptions {
   // to. Unless chosen otherwise, the default is "daemon" for user and group.
   const char *drop_priv_user;
   const char *drop_priv_group;
+
+  // Instead of the GPIO hardware, use an in-memory emulation that only counts
+  // what would be written. Works on any machine without root; useful to test
+  // and benchmark the refresh loop.
+  bool emulate_gpio;
+};
+
+/**
+ * Timing of the refresh loop, see led_matrix_get_refresh_stats().
+ * Histogram bucket i counts durations of [2^i, 2^(i+1)) microseconds; the
+ * first bucket also counts zero, the last one everything longer.
+ */
+#define RGB_LED_REFRESH_STATS_BUCKETS 16
+struct RGBLedRefreshStats {
+  uint64_t frames;            /* Frames written to the matrix. */
+  uint64_t missed_deadlines;  /* Frames longer than limit_refresh_rate_hz. */
+  uint64_t frame_usec[RGB_LED_REFRESH_STATS_BUCKETS];
+  uint64_t dump_usec[RGB_LED_REFRESH_STATS_BUCKETS];
+  uint64_t oe_wait_usec[RGB_LED_REFRESH_STATS_BUCKETS];  /* 1/17 frames. */
+  uint64_t swap_latency_usec[RGB_LED_REFRESH_STATS_BUCKETS];
 };
 
 /**
@@ -356,6 +382,19 @@ struct LedCanvas *led_matrix_create_offscreen_canvas(struct RGBLedMatrix *matrix
 struct LedCanvas *led_matrix_swap_on_vsync(struct RGBLedMatrix *matrix,
                                            struct LedCanvas *canvas);
 
+/**
+ * With triple_buffering: like led_matrix_swap_on_vsync(), but does not wait
+ * for vsync. Returns a canvas that is free to draw on.
+ */
+struct LedCanvas *led_matrix_publish_frame(struct RGBLedMatrix *matrix,
+                                           struct LedCanvas *canvas);
+
+/**
+ * Get a snapshot of the refresh loop timing since start.
+ */
+void led_matrix_get_refresh_stats(struct RGBLedMatrix *matrix,
+                                  struct RGBLedRefreshStats *stats);
+
 uint8_t led_matrix_get_brightness(struct RGBLedMatrix *matrix);
 void led_matrix_set_brightness(struct RGBLedMatrix *matrix, uint8_t brightness);
 
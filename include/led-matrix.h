@@ -159,6 +159,12 @@ public:
     // Sleep instead of busy wait to free CPU cycles but get slightly less
     // accurate frame timing.
     bool disable_busy_waiting;   // Flag: --led-busy-waiting
+
+    // Hand frames to the refresh thread through a lock-free triple buffer
+    // instead of a mutex and condition variable. The refresh thread then never
+    // waits for a producer, and PublishFrame() allows to hand over frames
+    // without waiting for VSync. Uses one additional FrameCanvas internally.
+    bool triple_buffering;       // Flag: --led-triple-buffer
   };
 
   // Factory to create a matrix. Additional functionality includes dropping
@@ -238,6 +244,14 @@ public:
   // time-correct animations.
   FrameCanvas *SwapOnVSync(FrameCanvas *other, unsigned framerate_fraction = 1);
 
+  // With Options::triple_buffering: hand over the frame to be shown from the
+  // next VSync on, but return immediately. Returns a buffer that is neither
+  // shown nor pending, free to draw the next frame on. If frames are
+  // published faster than shown, the ones in between are dropped.
+  // Only meant to be used from a single producer thread.
+  // Without triple buffering, this is the same as SwapOnVSync().
+  FrameCanvas *PublishFrame(FrameCanvas *other);
+
   // -- Setting shape and behavior of matrix.
 
   // Apply a pixel mapper. This is used to re-map pixels according to some
@@ -270,6 +284,11 @@ public:
   void SetBrightness(uint8_t brightness);
   uint8_t brightness();
 
+  // Set the color calibration (see ColorCalibration in graphics.h) for all
+  // created FrameCanvas and the ones created later.
+  // This will only affect newly set pixels.
+  void SetColorCalibration(const ColorCalibration &calibration);
+
   //-- GPIO interaction.
   // This library uses the GPIO pins to drive the matrix; this is a safe way
   // to request the 'remaining' bits to be used for user purposes.
@@ -326,6 +345,42 @@ public:
   // otherwise the refresh thread is already started.
   bool StartRefresh();
 
+  // Counters of the emulated GPIO (see RuntimeOptions::emulate_gpio).
+  // Register writes and clock/strobe edges are only counted if the library
+  // is compiled with EMULATED_GPIO_COUNT_WRITES (see lib/Makefile).
+  struct EmulatedGPIOStats {
+    uint64_t frames;          // Frames fully written to the matrix.
+    uint64_t set_writes;      // Writes to the set-bits register.
+    uint64_t clear_writes;    // Writes to the clear-bits register.
+    uint64_t clock_edges;     // Rising edges on the clock line.
+    uint64_t strobes;         // Rising edges on the strobe line.
+    uint64_t oe_pulses;       // Output enable pulses sent.
+    uint64_t oe_nanoseconds;  // Sum of requested output enable pulse times.
+  };
+
+  // If running on the emulated GPIO, fill "stats" with the counters
+  // accumulated since start and return true. Returns false on hardware.
+  bool GetEmulatedGPIOStats(EmulatedGPIOStats *stats) const;
+
+  // Timing of the refresh loop since start. Durations are counted in
+  // histograms: bucket i counts durations of [2^i, 2^(i+1)) microseconds;
+  // the first bucket also counts zero, the last one everything longer.
+  struct RefreshStats {
+    static const int kHistogramBuckets = 16;
+    uint64_t frames;            // Frames written to the matrix.
+    uint64_t missed_deadlines;  // Frames longer than limit_refresh_rate_hz
+                                // allows for.
+    uint64_t frame_usec[kHistogramBuckets];    // Full frame incl. waiting.
+    uint64_t dump_usec[kHistogramBuckets];     // Writing frame to the matrix.
+    uint64_t oe_wait_usec[kHistogramBuckets];  // Part of that waiting for OE;
+                                               // every 17th frame only.
+    uint64_t swap_latency_usec[kHistogramBuckets];  // Swap request to shown.
+  };
+
+  // Get a snapshot of the refresh loop timing. Cheap enough to be polled
+  // regularly, e.g. by monitoring.
+  void GetRefreshStats(RefreshStats *stats) const;
+
 private:
   class Impl;
 
@@ -353,6 +408,12 @@ public:
   void SetBrightness(uint8_t brightness);
   uint8_t brightness();
 
+  // Color calibration of this frame, see ColorCalibration in graphics.h.
+  // Like brightness, this only affects newly set pixels. Colors are mapped
+  // through a table that is only recalculated when any of these change.
+  void SetColorCalibration(const ColorCalibration &calibration);
+  const ColorCalibration &color_calibration() const;
+
   //-- Serialize()/Deserialize() are fast ways to store and re-create a canvas.
 
   // Provides a pointer to a buffer of the internal representation to
@@ -377,6 +438,46 @@ public:
   // Copy content from other FrameCanvas owned by the same RGBMatrix.
   void CopyFrom(const FrameCanvas &other);
 
+  //-- Incremental updates.
+  // The canvas keeps track of which internal double-rows (panel rows y and
+  // y + rows/2 are shown together) are modified. Bit n of the returned bitmaps
+  // stands for double-row n.
+
+  // Double-rows modified since the last ClearDirtyRows().
+  uint64_t DirtyRows() const;
+  void ClearDirtyRows();
+
+  // Like CopyFrom(), but only copies the double-rows given in the bitmap,
+  // e.g. other.DirtyRows().
+  void CopyRowsFrom(const FrameCanvas &other, uint64_t rows);
+
+  // Returns the bitmap of double-rows in which the content differs from other.
+  uint64_t DiffRows(const FrameCanvas &other) const;
+
+  // Like Serialize(), but only the part representing one double-row. The
+  // Serialize() output is all double-rows concatenated in order.
+  void SerializeRow(int double_row, const char **data, size_t *len) const;
+
+  // XOR "len" bytes of "data" into the Serialize() representation starting
+  // at byte "offset", e.g. to apply the difference to a previous frame.
+  // Offset and length need to be multiples of the internal word size.
+  // Returns 'false' if out of range.
+  bool XorSerialized(size_t offset, const char *data, size_t len);
+
+  // Set a rectangle of pixels from a buffer with 3 bytes per pixel in RGB
+  // (or, with "is_bgr", BGR) order and "stride" bytes from row to row.
+  // Same as SetPixel() for each pixel, but a lot faster.
+  void SetPixelsFromBuffer(int x, int y, int width, int height,
+                           const uint8_t *buffer, size_t stride, bool is_bgr);
+
+  // Single color drawing, same as DrawLine(), DrawCircle() and
+  // FillRectangle() in graphics.h (which use these for a FrameCanvas), but
+  // without a SetPixel() call and color mapping for every pixel.
+  void DrawLine(int x0, int y0, int x1, int y1, int thickness,
+                const Color &color);
+  void DrawCircle(int x, int y, int radius, const Color &color);
+  void FillRectangle(int x, int y, int width, int height, const Color &color);
+
   // -- Canvas interface.
   virtual int width() const;
   virtual int height() const;
@@ -389,6 +490,7 @@ public:
 
 private:
   friend class RGBMatrix;
+  friend class DrawList;
 
   FrameCanvas(internal::Framebuffer *frame) : frame_(frame){}
   virtual ~FrameCanvas();   // Any FrameCanvas is owned by RGBMatrix.
@@ -439,6 +541,11 @@ struct RuntimeOptions {
   // to. Unless chosen otherwise, the default is "daemon" for user and group.
   const char *drop_priv_user;
   const char *drop_priv_group;
+
+  // Instead of the GPIO hardware, use an in-memory emulation that only counts
+  // what would be written. Works on any machine without root; useful to test
+  // and benchmark the refresh loop.
+  bool emulate_gpio;
 };
 
 // Convenience utility functions to read standard rgb-matrix flags and create
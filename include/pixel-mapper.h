@@ -20,6 +20,16 @@
 
 namespace rgb_matrix {
 
+// A mapping of visible (x, y) to matrix coordinates that is a rotation by
+// a multiple of 90 degrees and/or mirroring:
+//   matrix_x = xx * x + xy * y + x0
+//   matrix_y = yx * x + yy * y + y0
+// with each of xx, xy, yx, yy being -1, 0 or 1.
+struct PixelTransform {
+  int xx, xy, x0;
+  int yx, yy, y0;
+};
+
 // A pixel mapper is a way for you to map pixels of LED matrixes to a different
 // layout. If you have an implementation of a PixelMapper, you can give it
 // to the RGBMatrix::ApplyPixelMapper(), which then presents you a canvas
@@ -80,6 +90,16 @@ public:
   virtual void MapVisibleToMatrix(int matrix_width, int matrix_height,
                                   int visible_x, int visible_y,
                                   int *matrix_x, int *matrix_y) const = 0;
+
+  // Optional. If MapVisibleToMatrix() for the given matrix size can be
+  // expressed as a PixelTransform, fill in "transform" and return true.
+  // Chains of such mappers are then composed into one transform, which
+  // allows the FrameCanvas to write rows and images without per-pixel
+  // lookups.
+  virtual bool GetTransform(int matrix_width, int matrix_height,
+                            PixelTransform *transform) const {
+    return false;
+  }
 };
 
 // This is a place to register PixelMappers globally. If you register your
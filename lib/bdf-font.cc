@@ -20,10 +20,15 @@
 #include <inttypes.h>
 
 #include "graphics.h"
+#include "led-matrix.h"
 
+#include <fcntl.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <algorithm>
 #include <bitset>
@@ -38,12 +43,99 @@ namespace rgb_matrix {
 static constexpr int kMaxFontWidth = 196;
 typedef std::bitset<kMaxFontWidth> rowbitmap_t;
 
+// Horizontal run of set pixels in a glyph.
+struct GlyphSpan {
+  int16_t x, y;
+  int16_t length;
+};
+
 struct Font::Glyph {
   int device_width, device_height;
   int width, height;
   int x_offset, y_offset;
-  std::vector<rowbitmap_t> bitmap;  // contains 'height' elements.
+  const GlyphSpan *spans;   // Bitmap as runs, ordered by y, then x.
+  int span_count;
+  std::vector<GlyphSpan> span_storage;  // Unless spans are in mmap()ed file.
+
+  // Convert the bitmap into spans, so that drawing does not need to look at
+  // each bit. Spans cover the full bitmap; drawing clips to device_width.
+  void SetBitmap(const std::vector<rowbitmap_t> &bitmap);
+  void GetBitmap(std::vector<rowbitmap_t> *bitmap) const;
+};
+
+// Binary font file, as written by WriteBinaryFont(): header, followed by
+// all glyphs ordered by codepoint, followed by the spans of all glyphs.
+// Stored in host byte order.
+static const char kBinaryFontMagic[8] = { 'R','G','B','F','O','N','T','1' };
+struct BinaryFontHeader {
+  char magic[8];
+  int32_t font_height;
+  int32_t base_line;
+  uint32_t glyph_count;
+  uint32_t span_count;
 };
+struct BinaryFontGlyph {
+  uint32_t codepoint;
+  int16_t device_width, device_height;
+  int16_t width, height;
+  int16_t x_offset, y_offset;
+  uint32_t first_span;
+  uint32_t span_count;
+};
+static_assert(sizeof(BinaryFontHeader) == 24, "Unexpected padding");
+static_assert(sizeof(BinaryFontGlyph) == 24, "Unexpected padding");
+static_assert(sizeof(GlyphSpan) == 6, "Unexpected padding");
+
+// Spans need to be inside the glyph bitmap and ordered, as that is what
+// drawing and GetBitmap() rely on.
+static bool ValidBinaryGlyph(const BinaryFontGlyph &b, const GlyphSpan *spans) {
+  if (b.height < 0 || b.width < 0 || b.device_width < 0
+      || b.device_width > kMaxFontWidth) {
+    return false;
+  }
+  int last_y = 0;
+  for (uint32_t i = 0; i < b.span_count; ++i) {
+    const GlyphSpan &span = spans[i];
+    if (span.y < last_y || span.y >= b.height || span.x < 0
+        || span.length <= 0 || span.x + span.length > kMaxFontWidth) {
+      return false;
+    }
+    last_y = span.y;
+  }
+  return true;
+}
+
+void Font::Glyph::SetBitmap(const std::vector<rowbitmap_t> &bitmap) {
+  span_storage.clear();
+  for (size_t y = 0; y < bitmap.size(); ++y) {
+    const rowbitmap_t &row = bitmap[y];
+    int x = 0;
+    while (x < kMaxFontWidth) {
+      if (!row.test(kMaxFontWidth - 1 - x)) {
+        ++x;
+        continue;
+      }
+      GlyphSpan span;
+      span.x = x;
+      span.y = y;
+      while (x < kMaxFontWidth && row.test(kMaxFontWidth - 1 - x)) ++x;
+      span.length = x - span.x;
+      span_storage.push_back(span);
+    }
+  }
+  spans = span_storage.empty() ? NULL : &span_storage[0];
+  span_count = span_storage.size();
+}
+
+void Font::Glyph::GetBitmap(std::vector<rowbitmap_t> *bitmap) const {
+  bitmap->assign(height, rowbitmap_t());
+  for (int i = 0; i < span_count; ++i) {
+    const GlyphSpan &span = spans[i];
+    for (int x = span.x; x < span.x + span.length; ++x) {
+      (*bitmap)[span.y].set(kMaxFontWidth - 1 - x);
+    }
+  }
+}
 
 static bool readNibble(char c, uint8_t* val) {
   if (c >= '0' && c <= '9') { *val = c - '0'; return true; }
@@ -66,12 +158,30 @@ static bool parseBitmap(const char *buffer, rowbitmap_t* result) {
   return true;
 }
 
-Font::Font() : font_height_(-1), base_line_(0) {}
+Font::Font() : font_height_(-1), base_line_(0),
+               mapped_file_(NULL), mapped_size_(0) {
+  for (int i = 0; i < kGlyphPages; ++i) glyph_pages_[i] = NULL;
+}
 Font::~Font() {
   for (CodepointGlyphMap::iterator it = glyphs_.begin();
        it != glyphs_.end(); ++it) {
     delete it->second;
   }
+  for (int i = 0; i < kGlyphPages; ++i) delete [] glyph_pages_[i];
+  if (mapped_file_) munmap(mapped_file_, mapped_size_);
+}
+
+void Font::AddGlyph(uint32_t codepoint, Glyph *glyph) {
+  delete glyphs_[codepoint];  // just in case there was one.
+  glyphs_[codepoint] = glyph;
+
+  const uint32_t page = codepoint >> 8;
+  if (page >= (uint32_t)kGlyphPages) return;  // Outside BMP: map only.
+  if (glyph_pages_[page] == NULL) {
+    glyph_pages_[page] = new Glyph*[256];
+    std::fill(glyph_pages_[page], glyph_pages_[page] + 256, (Glyph*)NULL);
+  }
+  glyph_pages_[page][codepoint & 0xff] = glyph;
 }
 
 // TODO: that might not be working for all input files yet.
@@ -80,11 +190,20 @@ bool Font::LoadFont(const char *path) {
   FILE *f = fopen(path, "r");
   if (f == NULL)
     return false;
+  char magic[sizeof(kBinaryFontMagic)];
+  if (fread(magic, sizeof(magic), 1, f) == 1
+      && memcmp(magic, kBinaryFontMagic, sizeof(magic)) == 0) {
+    fclose(f);
+    return LoadBinaryFont(path);
+  }
+  rewind(f);
+
   uint32_t codepoint;
   char buffer[1024];
   int dummy;
   Glyph tmp;
   Glyph *current_glyph = NULL;
+  std::vector<rowbitmap_t> bitmap;
   int row = 0;
 
   while (fgets(buffer, sizeof(buffer), f)) {
@@ -105,20 +224,20 @@ bool Font::LoadFont(const char *path) {
                     &tmp.x_offset, &tmp.y_offset) == 4) {
       current_glyph = new Glyph();
       *current_glyph = tmp;
-      current_glyph->bitmap.resize(tmp.height);
+      bitmap.assign(tmp.height, rowbitmap_t());
       row = -1;  // let's not start yet, wait for BITMAP
     }
     else if (strncmp(buffer, "BITMAP", strlen("BITMAP")) == 0) {
       row = 0;
     }
     else if (current_glyph && row >= 0 && row < current_glyph->height
-             && parseBitmap(buffer, &current_glyph->bitmap[row])) {
+             && parseBitmap(buffer, &bitmap[row])) {
       row++;
     }
     else if (strncmp(buffer, "ENDCHAR", strlen("ENDCHAR")) == 0) {
       if (current_glyph && row == current_glyph->height) {
-        delete glyphs_[codepoint];  // just in case there was one.
-        glyphs_[codepoint] = current_glyph;
+        current_glyph->SetBitmap(bitmap);
+        AddGlyph(codepoint, current_glyph);
         current_glyph = NULL;
       }
     }
@@ -127,6 +246,106 @@ bool Font::LoadFont(const char *path) {
   return true;
 }
 
+bool Font::LoadBinaryFont(const char *path) {
+  if (mapped_file_ != NULL) return false;  // Only one per font.
+  const int fd = open(path, O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(BinaryFontHeader)) {
+    close(fd);
+    return false;
+  }
+  void *const mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) return false;
+
+  const char *const data = (const char*) mapped;
+  const BinaryFontHeader *header = (const BinaryFontHeader*) data;
+  // In 64 bit, so that a corrupt header can't wrap around on 32 bit systems.
+  const uint64_t expected_size = sizeof(BinaryFontHeader)
+    + (uint64_t)header->glyph_count * sizeof(BinaryFontGlyph)
+    + (uint64_t)header->span_count * sizeof(GlyphSpan);
+  if (expected_size != (uint64_t)st.st_size) {
+    fprintf(stderr, "%s: unexpected size of binary font.\n", path);
+    munmap(mapped, st.st_size);
+    return false;
+  }
+  mapped_file_ = mapped;
+  mapped_size_ = st.st_size;
+
+  font_height_ = header->font_height;
+  base_line_ = header->base_line;
+  const BinaryFontGlyph *glyphs
+    = (const BinaryFontGlyph*) (data + sizeof(BinaryFontHeader));
+  const GlyphSpan *spans = (const GlyphSpan*) (glyphs + header->glyph_count);
+  int rejected = 0;
+  for (uint32_t i = 0; i < header->glyph_count; ++i) {
+    const BinaryFontGlyph &b = glyphs[i];
+    if ((uint64_t)b.first_span + b.span_count > header->span_count
+        || !ValidBinaryGlyph(b, spans + b.first_span)) {
+      ++rejected;  // Corrupt; ignore.
+      continue;
+    }
+    Glyph *const glyph = new Glyph();
+    glyph->device_width = b.device_width;
+    glyph->device_height = b.device_height;
+    glyph->width = b.width;
+    glyph->height = b.height;
+    glyph->x_offset = b.x_offset;
+    glyph->y_offset = b.y_offset;
+    glyph->spans = spans + b.first_span;
+    glyph->span_count = b.span_count;
+    AddGlyph(b.codepoint, glyph);
+  }
+  if (rejected) {
+    fprintf(stderr, "%s: ignored %d corrupt glyph%s.\n", path, rejected,
+            rejected == 1 ? "" : "s");
+  }
+  return true;
+}
+
+bool Font::WriteBinaryFont(const char *path) const {
+  FILE *f = fopen(path, "wb");
+  if (f == NULL) return false;
+  BinaryFontHeader header;
+  memcpy(header.magic, kBinaryFontMagic, sizeof(header.magic));
+  header.font_height = font_height_;
+  header.base_line = base_line_;
+  header.glyph_count = glyphs_.size();
+  header.span_count = 0;
+  for (CodepointGlyphMap::const_iterator it = glyphs_.begin();
+       it != glyphs_.end(); ++it) {
+    header.span_count += it->second->span_count;
+  }
+  bool success = fwrite(&header, sizeof(header), 1, f) == 1;
+
+  uint32_t first_span = 0;
+  for (CodepointGlyphMap::const_iterator it = glyphs_.begin();
+       success && it != glyphs_.end(); ++it) {
+    const Glyph *g = it->second;
+    BinaryFontGlyph b;
+    b.codepoint = it->first;
+    b.device_width = g->device_width;
+    b.device_height = g->device_height;
+    b.width = g->width;
+    b.height = g->height;
+    b.x_offset = g->x_offset;
+    b.y_offset = g->y_offset;
+    b.first_span = first_span;
+    b.span_count = g->span_count;
+    first_span += g->span_count;
+    success = fwrite(&b, sizeof(b), 1, f) == 1;
+  }
+  for (CodepointGlyphMap::const_iterator it = glyphs_.begin();
+       success && it != glyphs_.end(); ++it) {
+    const Glyph *g = it->second;
+    if (g->span_count == 0) continue;
+    success = fwrite(g->spans, sizeof(GlyphSpan), g->span_count, f)
+      == (size_t)g->span_count;
+  }
+  return (fclose(f) == 0) && success;
+}
+
 Font *Font::CreateOutlineFont() const {
   Font *r = new Font();
   const int kBorder = 1;
@@ -135,9 +354,11 @@ Font *Font::CreateOutlineFont() const {
   for (CodepointGlyphMap::const_iterator it = glyphs_.begin();
        it != glyphs_.end(); ++it) {
     const Glyph *orig = it->second;
+    std::vector<rowbitmap_t> orig_glyph_bitmap;
+    orig->GetBitmap(&orig_glyph_bitmap);
     const int height = orig->height + 2 * kBorder;
     Glyph *const tmp_glyph = new Glyph();
-    tmp_glyph->bitmap.resize(height);
+    std::vector<rowbitmap_t> bitmap(height);
     tmp_glyph->width  = orig->width  + 2*kBorder;
     tmp_glyph->height = height;
     tmp_glyph->device_width  = orig->device_width + 2*kBorder;
@@ -149,26 +370,32 @@ Font *Font::CreateOutlineFont() const {
     // Fill the border
     for (int h = 0; h < orig->height; ++h) {
       rowbitmap_t fill = fill_pattern;
-      rowbitmap_t orig_bitmap = orig->bitmap[h] >> kBorder;
+      rowbitmap_t orig_bitmap = orig_glyph_bitmap[h] >> kBorder;
       for (rowbitmap_t m = start_mask; m.any(); m <<= 1, fill <<= 1) {
         if ((orig_bitmap & m).any()) {
-          tmp_glyph->bitmap[h+kBorder-1] |= fill;
-          tmp_glyph->bitmap[h+kBorder+0] |= fill;
-          tmp_glyph->bitmap[h+kBorder+1] |= fill;
+          bitmap[h+kBorder-1] |= fill;
+          bitmap[h+kBorder+0] |= fill;
+          bitmap[h+kBorder+1] |= fill;
         }
       }
     }
     // Remove original font again.
     for (int h = 0; h < orig->height; ++h) {
-      rowbitmap_t orig_bitmap = orig->bitmap[h] >> kBorder;
-      tmp_glyph->bitmap[h+kBorder] &= ~orig_bitmap;
+      rowbitmap_t orig_bitmap = orig_glyph_bitmap[h] >> kBorder;
+      bitmap[h+kBorder] &= ~orig_bitmap;
     }
-    r->glyphs_[it->first] = tmp_glyph;
+    tmp_glyph->SetBitmap(bitmap);
+    r->AddGlyph(it->first, tmp_glyph);
   }
   return r;
 }
 
 const Font::Glyph *Font::FindGlyph(uint32_t unicode_codepoint) const {
+  const uint32_t page = unicode_codepoint >> 8;
+  if (page < (uint32_t)kGlyphPages) {
+    return glyph_pages_[page] ? glyph_pages_[page][unicode_codepoint & 0xff]
+                              : NULL;
+  }
   CodepointGlyphMap::const_iterator found = glyphs_.find(unicode_codepoint);
   if (found == glyphs_.end())
     return NULL;
@@ -193,15 +420,48 @@ int Font::DrawGlyph(Canvas *c, int x_pos, int y_pos,
     return g->device_width;  // Outside canvas border. Bail out early.
   }
 
+  // A FrameCanvas writes each horizontal run straight into its bitplanes.
+  FrameCanvas *const frame = dynamic_cast<FrameCanvas*>(c);
+  auto draw_run = [c, frame](int x, int y, int length, const Color &col) {
+    if (length <= 0) return;
+    if (frame != NULL) {
+      frame->FillRectangle(x, y, length, 1, col);
+      return;
+    }
+    for (const int end = x + length; x < end; ++x) {
+      c->SetPixel(x, y, col.r, col.g, col.b);
+    }
+  };
+
+  if (bgcolor != NULL && frame != NULL) {
+    // Fewer calls if the background is filled at once and the glyph drawn
+    // over it.
+    frame->FillRectangle(x_pos, y_pos, g->device_width, g->height, *bgcolor);
+    bgcolor = NULL;
+  }
+
+  if (bgcolor == NULL) {
+    for (int i = 0; i < g->span_count; ++i) {
+      const GlyphSpan &span = g->spans[i];
+      const int end = std::min(span.x + span.length, g->device_width);
+      draw_run(x_pos + span.x, y_pos + span.y, end - span.x, color);
+    }
+    return g->device_width;
+  }
+
+  // With background, fill the gaps between spans of each row.
+  const GlyphSpan *span = g->spans;
+  const GlyphSpan *const spans_end = g->spans + g->span_count;
   for (int y = 0; y < g->height; ++y) {
-    const rowbitmap_t& row = g->bitmap[y];
-    for (int x = 0; x < g->device_width; ++x) {
-      if (row.test(kMaxFontWidth - 1 - x)) {
-        c->SetPixel(x_pos + x, y_pos + y, color.r, color.g, color.b);
-      } else if (bgcolor) {
-        c->SetPixel(x_pos + x, y_pos + y, bgcolor->r, bgcolor->g, bgcolor->b);
-      }
+    int x = 0;
+    for (/**/; span != spans_end && span->y == y; ++span) {
+      const int end = std::min(span->x + span->length, g->device_width);
+      const int start = std::min<int>(span->x, end);
+      draw_run(x_pos + x, y_pos + y, start - x, *bgcolor);
+      draw_run(x_pos + start, y_pos + y, end - start, color);
+      x = std::max(x, end);
     }
+    draw_run(x_pos + x, y_pos + y, g->device_width - x, *bgcolor);
   }
   return g->device_width;
 }
@@ -211,4 +471,28 @@ int Font::DrawGlyph(Canvas *c, int x_pos, int y_pos, const Color &color,
   return DrawGlyph(c, x_pos, y_pos, color, NULL, unicode_codepoint);
 }
 
+int Font::DrawGlyph(DrawList *list, int x_pos, int y_pos,
+                    const Color &color, const Color *bgcolor,
+                    uint32_t unicode_codepoint) const {
+  const Glyph *g = FindGlyph(unicode_codepoint);
+  if (g == NULL) g = FindGlyph(kUnicodeReplacementCodepoint);
+  if (g == NULL) return 0;
+  y_pos = y_pos - g->height - g->y_offset;
+
+  // The glyph is drawn over its background, so each pixel is still only
+  // written once.
+  if (bgcolor != NULL) {
+    list->FillRectangle(x_pos, y_pos, g->device_width, g->height, *bgcolor);
+  }
+  for (int i = 0; i < g->span_count; ++i) {
+    const GlyphSpan &span = g->spans[i];
+    const int end = std::min(span.x + span.length, g->device_width);
+    if (end > span.x) {
+      list->FillRectangle(x_pos + span.x, y_pos + span.y, end - span.x, 1,
+                          color);
+    }
+  }
+  return g->device_width;
+}
+
 }  // namespace rgb_matrix
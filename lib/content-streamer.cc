@@ -27,27 +27,57 @@ namespace {
 // the Raspberry Pi, but also x86; so it is possible to create streams easily
 // on a different x86 Linux PC.
 static const uint32_t kFileMagicValue = 0xED0C5A48;
+
+// Version 0 streams only have complete frames. Version 1 has key frames
+// and delta frames.
+static const uint32_t kStreamVersion = 1;
 struct FileHeader {
   uint32_t magic;  // kFileMagicValue
   uint32_t buf_size;
   uint32_t width;
   uint32_t height;
-  uint64_t future_use1;
+  uint32_t version;
+  uint32_t row_size;  // Bytes per double-row; all of them make buf_size.
   uint64_t is_wide_gpio : 1;
   uint64_t flags_future_use : 63;
 };
 STATIC_ASSERT(file_header_size_changed, sizeof(FileHeader) == 32);
 
 static const uint32_t kFrameMagicValue = 0x12345678;
+enum FrameType {
+  kKeyFrame = 0,    // The serialized frame.
+  kDeltaFrame = 1,  // DeltaRuns to XOR into the previous frame.
+};
 struct FrameHeader {
   uint32_t magic;  // kFrameMagic
   uint32_t size;
   uint32_t hold_time_us;  // How long this frame lasts in usec.
-  uint32_t future_use1;
-  uint64_t future_use2;
+  uint32_t type;          // FrameType
+  uint64_t changed_rows;  // Double-rows a kDeltaFrame modifies.
   uint64_t future_use3;
 };
 STATIC_ASSERT(file_header_size_changed, sizeof(FrameHeader) == 32);
+
+// The optional index follows the last frame: an IndexHeader, a
+// StreamIndexEntry for each frame and the same IndexHeader again, so that it
+// can be found from the end of the stream.
+static const uint32_t kIndexMagicValue = 0x1DE7F00D;
+struct IndexHeader {
+  uint32_t magic;  // kIndexMagicValue
+  uint32_t frames;
+  uint64_t offset;       // Position of the first IndexHeader.
+  uint64_t duration_us;  // Sum of all hold times.
+  uint64_t future_use;
+};
+STATIC_ASSERT(index_header_size_changed, sizeof(IndexHeader) == 32);
+STATIC_ASSERT(index_entry_size_changed, sizeof(StreamIndexEntry) == 16);
+
+// A kDeltaFrame is a sequence of DeltaRuns, each followed by "count" words to
+// XOR into the previous frame "skip" words after where the last run ended.
+struct DeltaRun {
+  uint32_t skip;
+  uint32_t count;
+};
 }
 
 FileStreamIO::FileStreamIO(int fd) : fd_(fd) {
@@ -65,6 +95,16 @@ ssize_t FileStreamIO::Append(const void *buf, const size_t count) {
   return write(fd_, buf, count);
 }
 
+bool FileStreamIO::Seek(size_t offset) {
+  return lseek(fd_, offset, SEEK_SET) == (off_t)offset;
+}
+
+ssize_t FileStreamIO::Size() {
+  struct stat s;
+  if (fstat(fd_, &s) < 0 || !S_ISREG(s.st_mode)) return -1;
+  return s.st_size;
+}
+
 void MemStreamIO::Rewind() { pos_ = 0; }
 ssize_t MemStreamIO::Read(void *buf, size_t count) {
   const size_t amount = std::min(count, buffer_.size() - pos_);
@@ -76,8 +116,14 @@ ssize_t MemStreamIO::Append(const void *buf, size_t count) {
   buffer_.append((const char*)buf, count);
   return count;
 }
+bool MemStreamIO::Seek(size_t offset) {
+  if (offset > buffer_.size()) return false;
+  pos_ = offset;
+  return true;
+}
 
-MemMapViewInput::MemMapViewInput(int fd) : buffer_(nullptr) {
+MemMapViewInput::MemMapViewInput(int fd)
+  : buffer_(nullptr), end_(nullptr), pos_(nullptr) {
   struct stat s;
   if (fstat(fd, &s) < 0) {
     close(fd);
@@ -86,12 +132,13 @@ MemMapViewInput::MemMapViewInput(int fd) : buffer_(nullptr) {
   }
 
   const size_t file_size = s.st_size;
-  buffer_ = (char*)mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+  void *const mapped = mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
   close(fd);
-  if (buffer_ == MAP_FAILED) {
+  if (mapped == MAP_FAILED) {
     perror("Can't mmmap()");
     return;
   }
+  buffer_ = pos_ = (char*)mapped;
   end_ = buffer_ + file_size;
 #ifdef POSIX_MADV_WILLNEED
   // Trigger read-ahead if possible.
@@ -101,22 +148,28 @@ MemMapViewInput::MemMapViewInput(int fd) : buffer_(nullptr) {
 
 void MemMapViewInput::Rewind() { pos_ = buffer_; }
 ssize_t MemMapViewInput::Read(void *buf, size_t count) {
-  if (pos_ + count >= end_) return -1;
+  if (pos_ + count > end_) return -1;
   memcpy(buf, pos_, count);
   pos_ += count;
   return count;
 }
 
+bool MemMapViewInput::Seek(size_t offset) {
+  if (offset > (size_t)(end_ - buffer_)) return false;
+  pos_ = buffer_ + offset;
+  return true;
+}
+
 MemMapViewInput::~MemMapViewInput() {
   if (buffer_) munmap(buffer_, end_ - buffer_);
 }
 
 // Read exactly count bytes including retries. Returns success.
 static bool FullRead(StreamIO *io, void *buf, const size_t count) {
-  int remaining = count;
+  size_t remaining = count;
   char *char_buffer = (char*)buf;
   while (remaining > 0) {
-    int r = io->Read(char_buffer, remaining);
+    ssize_t r = io->Read(char_buffer, remaining);
     if (r < 0) return false;
     if (r == 0) break;  // EOF.
     char_buffer += r; remaining -= r;
@@ -126,17 +179,21 @@ static bool FullRead(StreamIO *io, void *buf, const size_t count) {
 
 // Write exactly count bytes including retries. Returns success.
 static bool FullAppend(StreamIO *io, const void *buf, const size_t count) {
-  int remaining = count;
+  size_t remaining = count;
   const char *char_buffer = (const char*) buf;
   while (remaining > 0) {
-    int w = io->Append(char_buffer, remaining);
+    ssize_t w = io->Append(char_buffer, remaining);
     if (w < 0) return false;
     char_buffer += w; remaining -= w;
   }
   return remaining == 0;
 }
 
-StreamWriter::StreamWriter(StreamIO *io) : io_(io), header_written_(false) {}
+StreamWriter::StreamWriter(StreamIO *io, int keyframe_interval)
+  : io_(io), keyframe_interval_(keyframe_interval), header_written_(false),
+    row_size_(0), frames_since_keyframe_(0), bytes_written_(0),
+    duration_us_(0) {}
+
 bool StreamWriter::Stream(const FrameCanvas &frame, uint32_t hold_time_us) {
   const char *data;
   size_t len;
@@ -147,45 +204,203 @@ bool StreamWriter::Stream(const FrameCanvas &frame, uint32_t hold_time_us) {
   }
   FrameHeader h = {};
   h.magic = kFrameMagicValue;
-  h.size = len;
   h.hold_time_us = hold_time_us;
+  const char *payload = data;
+  size_t payload_len = len;
+  if (frames_since_keyframe_ > 0 && frames_since_keyframe_ < keyframe_interval_
+      && previous_.size() == len && EncodeDelta(data, len, &h.changed_rows)) {
+    h.type = kDeltaFrame;
+    payload = delta_.data();
+    payload_len = delta_.size();
+    ++frames_since_keyframe_;
+  } else {
+    h.type = kKeyFrame;
+    frames_since_keyframe_ = 1;
+  }
+  h.size = payload_len;
+
+  StreamIndexEntry entry = {};
+  entry.offset = bytes_written_;
+  entry.is_key_frame = (h.type == kKeyFrame);
+  entry.start_time_us = duration_us_;
+  index_.push_back(entry);
+  duration_us_ += hold_time_us;
+  bytes_written_ += sizeof(h) + payload_len;
+
   FullAppend(io_, &h, sizeof(h));
-  return FullAppend(io_, data, len) == (ssize_t)len;
+  if (keyframe_interval_ > 1) previous_.assign(data, len);
+  return FullAppend(io_, payload, payload_len);
+}
+
+bool StreamWriter::WriteIndex() {
+  if (!header_written_) return false;  // No frames to index.
+  IndexHeader h = {};
+  h.magic = kIndexMagicValue;
+  h.frames = index_.size();
+  h.offset = bytes_written_;
+  h.duration_us = duration_us_;
+  return (FullAppend(io_, &h, sizeof(h))
+          && FullAppend(io_, index_.data(),
+                        index_.size() * sizeof(StreamIndexEntry))
+          && FullAppend(io_, &h, sizeof(h)));
+}
+
+bool StreamWriter::EncodeDelta(const char *data, size_t len,
+                               uint64_t *changed_rows) {
+  const gpio_bits_t *current = reinterpret_cast<const gpio_bits_t*>(data);
+  const gpio_bits_t *previous
+    = reinterpret_cast<const gpio_bits_t*>(previous_.data());
+  const size_t words = len / sizeof(gpio_bits_t);
+  // Unchanged words are kept in a run if that is cheaper than a new run.
+  const size_t kMaxGap = sizeof(DeltaRun) / sizeof(gpio_bits_t);
+
+  delta_.clear();
+  *changed_rows = 0;
+  size_t pos = 0;
+  size_t last_end = 0;
+  for (;;) {
+    while (pos < words && current[pos] == previous[pos]) ++pos;
+    if (pos == words) break;
+    const size_t start = pos;
+    size_t end = pos;
+    for (size_t gap = 0; pos < words && gap <= kMaxGap; ++pos) {
+      if (current[pos] != previous[pos]) {
+        end = pos + 1;
+        gap = 0;
+      } else {
+        ++gap;
+      }
+    }
+    pos = end;
+
+    const DeltaRun run = { (uint32_t)(start - last_end),
+                           (uint32_t)(end - start) };
+    const size_t at = delta_.size();
+    delta_.resize(at + sizeof(run) + run.count * sizeof(gpio_bits_t));
+    if (delta_.size() >= len) return false;
+    memcpy(&delta_[at], &run, sizeof(run));
+    gpio_bits_t *out
+      = reinterpret_cast<gpio_bits_t*>(&delta_[at + sizeof(run)]);
+    for (size_t i = start; i < end; ++i) {
+      *out++ = current[i] ^ previous[i];
+    }
+    const int first_row = start * sizeof(gpio_bits_t) / row_size_;
+    const int last_row = (end - 1) * sizeof(gpio_bits_t) / row_size_;
+    *changed_rows |= ((2ull << last_row) - 1) & ~((1ull << first_row) - 1);
+    last_end = end;
+  }
+  return true;
 }
 
 void StreamWriter::WriteFileHeader(const FrameCanvas &frame, size_t len) {
+  const char *row_data;
+  frame.SerializeRow(0, &row_data, &row_size_);
   FileHeader header = {};
   header.magic = kFileMagicValue;
   header.width = frame.width();
   header.height = frame.height();
   header.buf_size = len;
+  // Only key frames can be read by every version.
+  header.version = keyframe_interval_ > 1 ? kStreamVersion : 0;
+  header.row_size = row_size_;
   header.is_wide_gpio = (sizeof(gpio_bits_t) > 4);
   FullAppend(io_, &header, sizeof(header));
+  bytes_written_ += sizeof(header);
   header_written_ = true;
 }
 
 StreamReader::StreamReader(StreamIO *io)
-  : io_(io), state_(STREAM_AT_BEGIN), header_frame_buffer_(NULL) {
-  io_->Rewind();
+  : io_(io), state_(STREAM_AT_BEGIN), frame_buffer_(NULL),
+    last_frame_(NULL), duration_us_(0), seek_frame_(SIZE_MAX) {
+  // Only go back if looking for the index moved the stream, as Rewind() is
+  // not necessarily possible if there is no Seek() either.
+  if (LoadIndex()) io_->Rewind();
 }
-StreamReader::~StreamReader() { delete [] header_frame_buffer_; }
+StreamReader::~StreamReader() { delete [] frame_buffer_; }
 
 void StreamReader::Rewind() {
   io_->Rewind();
   state_ = STREAM_AT_BEGIN;
+  seek_frame_ = SIZE_MAX;
+}
+
+bool StreamReader::LoadIndex() {
+  const ssize_t size = io_->Size();
+  IndexHeader h;
+  if (size < (ssize_t)(sizeof(FileHeader) + 2 * sizeof(h))) return false;
+  if (!io_->Seek(size - sizeof(h))) return false;
+  if (!FullRead(io_, &h, sizeof(h))
+      || h.magic != kIndexMagicValue || h.frames == 0) {
+    return true;
+  }
+  // Check against the stream size before allocating anything, in 64 bit so
+  // that a corrupt header can't wrap around.
+  const uint64_t index_size = (uint64_t)h.frames * sizeof(StreamIndexEntry);
+  if (index_size > (uint64_t)size || h.offset > (uint64_t)size
+      || h.offset + index_size + 2 * sizeof(h) != (uint64_t)size) {
+    return true;
+  }
+  std::vector<StreamIndexEntry> index(h.frames);
+  if (!io_->Seek(h.offset + sizeof(h))
+      || !FullRead(io_, index.data(), index_size)
+      || !index[0].is_key_frame) {
+    return true;
+  }
+  for (size_t i = 0; i < index.size(); ++i) {
+    if (index[i].is_key_frame) key_frames_.push_back(i);
+  }
+  index_.swap(index);
+  duration_us_ = h.duration_us;
+  return true;
+}
+
+bool StreamReader::SeekToFrame(size_t frame_number) {
+  if (frame_number >= index_.size()) return false;
+  seek_frame_ = frame_number;
+  if (state_ == STREAM_AT_END) state_ = STREAM_READING;
+  return true;
+}
+
+bool StreamReader::SeekToTime(uint64_t time_us) {
+  if (time_us >= duration_us_) return false;
+  // The last frame starting at or before time_us.
+  std::vector<StreamIndexEntry>::const_iterator it = std::upper_bound(
+    index_.begin(), index_.end(), time_us,
+    [](uint64_t t, const StreamIndexEntry &e) { return t < e.start_time_us; });
+  return SeekToFrame(it - index_.begin() - 1);
 }
 
 bool StreamReader::GetNext(FrameCanvas *frame, uint32_t* hold_time_us) {
   if (state_ == STREAM_AT_BEGIN && !ReadFileHeader(*frame)) return false;
   if (state_ != STREAM_READING) return false;
 
-  // Read header and expected buffer size.
-  if (!FullRead(io_, header_frame_buffer_,
-                sizeof(FrameHeader) + frame_buf_size_)) {
-    return false;
+  size_t skip_frames = 0;
+  if (seek_frame_ != SIZE_MAX) {
+    // Deltas build on the previous frame, so start at the key frame before.
+    const size_t key_frame = *(std::upper_bound(key_frames_.begin(),
+                                                key_frames_.end(),
+                                                seek_frame_) - 1);
+    skip_frames = seek_frame_ - key_frame;
+    seek_frame_ = SIZE_MAX;
+    if (!io_->Seek(index_[key_frame].offset)) {
+      state_ = STREAM_ERROR;
+      return false;
+    }
   }
+  for (/**/; skip_frames > 0; --skip_frames) {
+    if (!ReadFrame(frame, NULL)) return false;
+  }
+  return ReadFrame(frame, hold_time_us);
+}
 
-  const FrameHeader &h = *reinterpret_cast<FrameHeader*>(header_frame_buffer_);
+bool StreamReader::ReadFrame(FrameCanvas *frame, uint32_t* hold_time_us) {
+  FrameHeader h;
+  if (!FullRead(io_, &h, sizeof(h))) return false;
+
+  if (h.magic == kIndexMagicValue) {
+    state_ = STREAM_AT_END;  // Only the index follows the last frame.
+    return false;
+  }
 
   // TODO: we might allow for this to be a kFileMagicValue, to allow people
   // to just concatenate streams. In that case, we just would need to read
@@ -195,17 +410,72 @@ bool StreamReader::GetNext(FrameCanvas *frame, uint32_t* hold_time_us) {
     return false;
   }
 
-  // In the future, we might allow larger buffers (audio?), but never smaller.
-  // For now, we need to make sure to exactly match the size, as our assumption
-  // above is that we can read the full header + frame in one FullRead().
-  if (h.size != frame_buf_size_)
+  // In the future, we might allow larger buffers (audio?), but for now
+  // frames are never larger than the frame buffer.
+  if (h.size > frame_buf_size_)
     return false;
+  if (!FullRead(io_, frame_buffer_, h.size)) return false;
 
   if (hold_time_us) *hold_time_us = h.hold_time_us;
-  return frame->Deserialize(header_frame_buffer_ + sizeof(FrameHeader),
-                            frame_buf_size_);
+  if (version_ == 0 || h.type == kKeyFrame) {
+    if (!frame->Deserialize(frame_buffer_, h.size)) return false;
+    FrameRead(frame, ~0ull);
+    return true;
+  }
+  if (h.type != kDeltaFrame || !ApplyDelta(frame, h.size)) {
+    state_ = STREAM_ERROR;
+    return false;
+  }
+  FrameRead(frame, h.changed_rows);
+  return true;
 }
 
+bool StreamReader::ApplyDelta(FrameCanvas *frame, size_t size) {
+  if (last_frame_ == NULL) return false;  // Needs a key frame first.
+  if (frame != last_frame_) {
+    uint64_t outdated_rows = ~0ull;
+    for (const CanvasState &c : canvases_) {
+      if (c.canvas == frame) outdated_rows = c.outdated_rows;
+    }
+    frame->CopyRowsFrom(*last_frame_, outdated_rows);
+  }
+  const char *pos = frame_buffer_;
+  const char *const end = frame_buffer_ + size;
+  size_t offset = 0;
+  while (pos < end) {
+    DeltaRun run;
+    if ((size_t)(end - pos) < sizeof(run)) return false;
+    memcpy(&run, pos, sizeof(run));
+    pos += sizeof(run);
+    offset += run.skip * sizeof(gpio_bits_t);
+    const size_t len = run.count * sizeof(gpio_bits_t);
+    if ((size_t)(end - pos) < len || !frame->XorSerialized(offset, pos, len))
+      return false;
+    pos += len;
+    offset += len;
+  }
+  return true;
+}
+
+void StreamReader::FrameRead(const FrameCanvas *frame, uint64_t changed_rows) {
+  // Usually there are two or three FrameCanvases taking turns.
+  static const size_t kMaxCanvases = 4;
+  bool known = false;
+  for (CanvasState &c : canvases_) {
+    if (c.canvas == frame) {
+      c.outdated_rows = 0;
+      known = true;
+    } else {
+      c.outdated_rows |= changed_rows;
+    }
+  }
+  if (!known) {
+    if (canvases_.size() == kMaxCanvases) canvases_.erase(canvases_.begin());
+    const CanvasState state = { frame, 0 };
+    canvases_.push_back(state);
+  }
+  last_frame_ = frame;
+}
 bool StreamReader::ReadFileHeader(const FrameCanvas &frame) {
   FileHeader header;
   FullRead(io_, &header, sizeof(header));
@@ -230,10 +500,17 @@ bool StreamReader::ReadFileHeader(const FrameCanvas &frame) {
     state_ = STREAM_ERROR;
     return false;
   }
+  if (header.version > kStreamVersion) {
+    fprintf(stderr, "Stream format version %u is newer than this library "
+            "supports (%u)\n", header.version, kStreamVersion);
+    state_ = STREAM_ERROR;
+    return false;
+  }
   state_ = STREAM_READING;
+  version_ = header.version;
   frame_buf_size_ = header.buf_size;
-  if (!header_frame_buffer_)
-    header_frame_buffer_ = new char [ sizeof(FrameHeader) + header.buf_size ];
+  if (!frame_buffer_)
+    frame_buffer_ = new char [ header.buf_size ];
   return true;
 }
 }  // namespace rgb_matrix
@@ -18,8 +18,11 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include <vector>
+
 #include "hardware-mapping.h"
 #include "../include/graphics.h"
+#include "../include/pixel-mapper.h"
 
 namespace rgb_matrix {
 class GPIO;
@@ -27,20 +30,37 @@ class PinPulser;
 namespace internal {
 class RowAddressSetter;
 
-// An opaque type used within the framebuffer that can be used
-// to copy between PixelMappers.
-struct PixelDesignator {
-  PixelDesignator() : gpio_word(-1), r_bit(0), g_bit(0), b_bit(0), mask(~0u){}
-  long gpio_word;
+// The GPIO bits a pixel is written with. There are only a handful of
+// different ones (one per parallel chain and panel half), so they are kept
+// once in the PixelDesignatorMap and referred to by index.
+struct PixelBits {
+  PixelBits() : r_bit(0), g_bit(0), b_bit(0), mask(~0u) {}
   gpio_bits_t r_bit;
   gpio_bits_t g_bit;
   gpio_bits_t b_bit;
   gpio_bits_t mask;
 };
 
+// An opaque type used within the framebuffer that can be used
+// to copy between PixelMappers. Packed into 32 bits to keep the map of
+// large chained displays small enough to stay in the cache.
+struct PixelDesignator {
+  static constexpr uint32_t kMaxGpioWord = (1 << 24) - 2;
+  static constexpr uint32_t kUnused = kMaxGpioWord + 1;
+
+  PixelDesignator() : gpio_word(kUnused), bits(0) {}
+  bool unused() const { return gpio_word == kUnused; }
+
+  uint32_t gpio_word : 24;  // Offset into the bitplane buffer.
+  uint32_t bits : 8;        // Index into PixelDesignatorMap::bits().
+};
+
 class PixelDesignatorMap {
 public:
-  PixelDesignatorMap(int width, int height, const PixelDesignator &fill_bits);
+  PixelDesignatorMap(int width, int height, const PixelBits &fill_bits);
+  // A map with the fill bits and PixelBits of "parent", so that its
+  // PixelDesignators can be copied over.
+  PixelDesignatorMap(int width, int height, const PixelDesignatorMap &parent);
   ~PixelDesignatorMap();
 
   // Get a writable version of the PixelDesignator. Outside Framebuffer used
@@ -51,12 +71,30 @@ public:
   inline int height() const { return height_; }
 
   // All bits that set red/green/blue pixels; used for Fill().
-  const PixelDesignator &GetFillColorBits() { return fill_bits_; }
+  const PixelBits &GetFillColorBits() { return fill_bits_; }
+
+  // The PixelBits a designator refers to.
+  inline const PixelBits &bits(const PixelDesignator &d) const {
+    return bits_[d.bits];
+  }
+
+  // Index of the given bits, adding them if not known yet.
+  uint8_t AddBits(const PixelBits &bits);
+
+  // If not NULL, the designator of each pixel is the one the Framebuffer
+  // initially gave the matrix pixel at this transform of its coordinates.
+  const PixelTransform *transform() const {
+    return has_transform_ ? &transform_ : NULL;
+  }
+  void SetTransform(const PixelTransform *transform);
 
 private:
   const int width_;
   const int height_;
-  const PixelDesignator fill_bits_;  // Precalculated for fill.
+  const PixelBits fill_bits_;  // Precalculated for fill.
+  std::vector<PixelBits> bits_;
+  bool has_transform_;
+  PixelTransform transform_;
   PixelDesignator *const buffer_;
 };
 
@@ -106,31 +144,60 @@ public:
   uint8_t pwmbits() { return pwm_bits_; }
 
   // Map brightness of output linearly to input with CIE1931 profile.
-  void set_luminance_correct(bool on) { do_luminance_correct_ = on; }
+  void set_luminance_correct(bool on);
   bool luminance_correct() const { return do_luminance_correct_; }
 
   // Set brightness in percent; range=1..100
   // This will only affect newly set pixels.
-  void SetBrightness(uint8_t b) {
-    brightness_ = (b <= 100 ? (b != 0 ? b : 1) : 100);
-  }
+  void SetBrightness(uint8_t b);
   uint8_t brightness() { return brightness_; }
 
-  void DumpToMatrix(GPIO *io, int pwm_bits_to_show);
+  // This will only affect newly set pixels.
+  void SetColorCalibration(const ColorCalibration &calibration);
+  const ColorCalibration &color_calibration() const { return calibration_; }
+
+  // If "oe_wait_usec" is given, the time spent waiting for output enable
+  // pulses to finish is added to it.
+  void DumpToMatrix(GPIO *io, int pwm_bits_to_show,
+                    uint32_t *oe_wait_usec = NULL);
 
   void Serialize(const char **data, size_t *len) const;
   bool Deserialize(const char *data, size_t len);
   void CopyFrom(const Framebuffer *other);
 
+  // Incremental updates. Each modification marks the double-rows it touched
+  // as dirty; bit n in the bitmaps below stands for double-row n.
+  uint64_t dirty_rows() const { return dirty_rows_; }
+  void ClearDirtyRows() { dirty_rows_ = 0; }
+  void CopyRowsFrom(const Framebuffer *other, uint64_t rows);
+  uint64_t DiffRows(const Framebuffer *other) const;
+  // The serialized bytes of a single double-row; all of these concatenated
+  // is what Serialize() returns.
+  void SerializeRow(int double_row, const char **data, size_t *len) const;
+  bool XorSerialized(size_t offset, const char *data, size_t len);
+
   // Canvas-inspired methods, but we're not implementing this interface to not
   // have an unnecessary vtable.
   int width() const;
   int height() const;
   void SetPixel(int x, int y, uint8_t red, uint8_t green, uint8_t blue);
   void SetPixels(int x, int y, int width, int height, Color *colors);
+  void SetPixelsFromBuffer(int x, int y, int width, int height,
+                           const uint8_t *buffer, size_t stride, bool is_bgr);
   void Clear();
   void Fill(uint8_t red, uint8_t green, uint8_t blue);
 
+  // Single color drawing; see FrameCanvas.
+  void DrawLine(int x0, int y0, int x1, int y1, int thickness,
+                uint8_t red, uint8_t green, uint8_t blue);
+  void DrawCircle(int x, int y, int radius,
+                  uint8_t red, uint8_t green, uint8_t blue);
+  void FillRectangle(int x, int y, int width, int height,
+                     uint8_t red, uint8_t green, uint8_t blue);
+
+  // Draw the content of "list", see DrawList::Flush().
+  void Draw(DrawList *list);
+
 private:
   static const struct HardwareMapping *hardware_mapping_;
   static RowAddressSetter *row_setter_;
@@ -142,10 +209,45 @@ private:
                                             gpio_bits_t default_g,
                                             gpio_bits_t default_b);
 
-  void InitDefaultDesignator(int x, int y, const char *led_sequence,
-                             PixelDesignator *designator);
+  // The bits of the pixels in matrix row "y".
+  PixelBits DefaultPixelBits(int y, const char *led_sequence);
+  void InitDefaultDesignator(int x, int y, PixelDesignator *designator);
   inline void  MapColors(uint8_t r, uint8_t g, uint8_t b,
                          uint16_t *red, uint16_t *green, uint16_t *blue);
+  // Recalculate color_lookup_ after a change of the color settings.
+  void UpdateColorLookup();
+
+  // A color mapped once for drawing many pixels: for each bitplane, all
+  // bits set in "r", "g", "b" if the color has that bit set.
+  struct PlaneColor {
+    gpio_bits_t r, g, b;
+  };
+  void MapPlaneColors(uint8_t r, uint8_t g, uint8_t b, PlaneColor *planes);
+  // Same, but keeps the last color mapped, as e.g. text is drawn in many
+  // small rectangles of the same color.
+  inline const PlaneColor *CachedPlaneColors(uint8_t r, uint8_t g, uint8_t b);
+  // Set pixel "x", "y" to a color from MapPlaneColors(). Adds the double-row
+  // to "touched_rows" instead of marking it dirty.
+  inline void SetMappedPixel(int x, int y, const PlaneColor *planes,
+                             uint64_t *touched_rows);
+
+  // If the pixel mapping is a PixelTransform, the visible pixels
+  // x .. x + length - 1 of row y are straight runs in the bitplane buffer.
+  // Calls run(pos, step, count, bits) for each, in visible order: pixel i
+  // of the run is at gpio word pos + i * step and written with "bits".
+  // Adds the double-rows of the runs to "touched_rows".
+  template <typename Run>
+  inline void ForEachMatrixRun(const PixelTransform &t, int x, int y,
+                               int length, uint64_t *touched_rows, Run run);
+
+  // All color bits of the used parallel chains plus clock.
+  static gpio_bits_t ColorClockMask(int parallel);
+
+  inline uint64_t AllRows() const { return (1ull << double_rows_) - 1; }
+  inline void MarkDirty(uint64_t rows) { dirty_rows_ |= rows; }
+
+  // The double-row shown at position "row_loop", depending on scan mode.
+  inline int DisplayRow(int row_loop) const;
   const int rows_;     // Number of rows. 16 or 32.
   const int parallel_; // Parallel rows of chains. 1 or 2.
   const int height_;   // rows * parallel
@@ -157,9 +259,16 @@ private:
   uint8_t pwm_bits_;   // PWM bits to display.
   bool do_luminance_correct_;
   uint8_t brightness_;
+  ColorCalibration calibration_;
+
+  // Channel value (red, green, blue) to its bitplane bits, with calibration,
+  // brightness, luminance correction and color inversion applied.
+  uint16_t color_lookup_[3][256];
 
   const int double_rows_;
   const size_t buffer_size_;
+  const int row_words_;   // gpio words per double-row: all its bitplanes.
+  const gpio_bits_t color_clk_mask_;
 
   // The frame-buffer is organized in bitplanes.
   // Highest level (slowest to cycle through) are double rows.
@@ -170,7 +279,17 @@ private:
   gpio_bits_t *bitplane_buffer_;
   inline gpio_bits_t *ValueAt(int double_row, int column, int bit);
 
+  uint64_t dirty_rows_;       // Modified since last ClearDirtyRows()
+
   PixelDesignatorMap **shared_mapper_;  // Storage in RGBMatrix.
+  std::vector<PixelBits> row_bits_;      // DefaultPixelBits() of each row.
+
+  // The colors of the DrawList being drawn, kBitPlanes entries per color.
+  std::vector<PlaneColor> mapped_colors_;
+
+  // Last color of CachedPlaneColors(): rgb and pwm_bits_, ~0 if none.
+  uint32_t cached_planes_key_;
+  PlaneColor cached_planes_[kBitPlanes];
 };
 }  // namespace internal
 }  // namespace rgb_matrix
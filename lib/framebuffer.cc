@@ -18,6 +18,7 @@
 // to manipulate the content.
 
 #include "framebuffer-internal.h"
+#include "graphics-internal.h"
 
 #include <assert.h>
 #include <ctype.h>
@@ -51,11 +52,39 @@ PixelDesignator *PixelDesignatorMap::get(int x, int y) {
 }
 
 PixelDesignatorMap::PixelDesignatorMap(int width, int height,
-                                       const PixelDesignator &fill_bits)
+                                       const PixelBits &fill_bits)
   : width_(width), height_(height), fill_bits_(fill_bits),
+    bits_(1),  // Index 0, the default, sets nothing.
+    has_transform_(true), transform_{ 1, 0, 0, 0, 1, 0 },
     buffer_(new PixelDesignator[width * height]) {
 }
 
+PixelDesignatorMap::PixelDesignatorMap(int width, int height,
+                                       const PixelDesignatorMap &parent)
+  : width_(width), height_(height), fill_bits_(parent.fill_bits_),
+    bits_(parent.bits_), has_transform_(false),
+    buffer_(new PixelDesignator[width * height]) {
+}
+
+void PixelDesignatorMap::SetTransform(const PixelTransform *transform) {
+  has_transform_ = (transform != NULL);
+  if (transform) transform_ = *transform;
+}
+
+uint8_t PixelDesignatorMap::AddBits(const PixelBits &bits) {
+  for (size_t i = 0; i < bits_.size(); ++i) {
+    if (bits_[i].r_bit == bits.r_bit && bits_[i].g_bit == bits.g_bit
+        && bits_[i].b_bit == bits.b_bit && bits_[i].mask == bits.mask)
+      return i;
+  }
+  if (bits_.size() > 0xff) {
+    fprintf(stderr, "Too many different pixel bit combinations.\n");
+    abort();
+  }
+  bits_.push_back(bits);
+  return bits_.size() - 1;
+}
+
 PixelDesignatorMap::~PixelDesignatorMap() {
   delete [] buffer_;
 }
@@ -297,10 +326,14 @@ Framebuffer::Framebuffer(int rows, int columns, int parallel,
     pwm_bits_(kBitPlanes), do_luminance_correct_(true), brightness_(100),
     double_rows_(rows / SUB_PANELS_),
     buffer_size_(double_rows_ * columns_ * kBitPlanes * sizeof(gpio_bits_t)),
-    shared_mapper_(mapper) {
+    row_words_(columns_ * kBitPlanes),
+    color_clk_mask_(ColorClockMask(parallel)),
+    dirty_rows_(0),
+    shared_mapper_(mapper), cached_planes_key_(~0u) {
   assert(hardware_mapping_ != NULL);   // Called InitHardwareMapping() ?
   assert(shared_mapper_ != NULL);  // Storage should be provided by RGBMatrix.
   assert(rows_ >=4 && rows_ <= 64 && rows_ % 2 == 0);
+  assert(double_rows_ <= 32);  // Fits in dirty-row bitmaps.
   if (parallel > hardware_mapping_->max_parallel_chains) {
     fprintf(stderr, "The %s GPIO mapping only supports %d parallel chain%s, "
             "but %d was requested.\n", hardware_mapping_->name,
@@ -310,8 +343,13 @@ Framebuffer::Framebuffer(int rows, int columns, int parallel,
   }
   assert(parallel >= 1 && parallel <= 6);
 
+  UpdateColorLookup();
   bitplane_buffer_ = new gpio_bits_t[double_rows_ * columns_ * kBitPlanes];
 
+  for (int y = 0; y < height_; ++y) {
+    row_bits_.push_back(DefaultPixelBits(y, led_sequence));
+  }
+
   // If we're the first Framebuffer created, the shared PixelMapper is
   // still NULL, so create one.
   // The first PixelMapper represents the physical layout of a standard matrix
@@ -327,15 +365,20 @@ Framebuffer::Framebuffer(int rows, int columns, int parallel,
     gpio_bits_t r = h.p0_r1 | h.p0_r2 | h.p1_r1 | h.p1_r2 | h.p2_r1 | h.p2_r2 | h.p3_r1 | h.p3_r2 | h.p4_r1 | h.p4_r2 | h.p5_r1 | h.p5_r2;
     gpio_bits_t g = h.p0_g1 | h.p0_g2 | h.p1_g1 | h.p1_g2 | h.p2_g1 | h.p2_g2 | h.p3_g1 | h.p3_g2 | h.p4_g1 | h.p4_g2 | h.p5_g1 | h.p5_g2;
     gpio_bits_t b = h.p0_b1 | h.p0_b2 | h.p1_b1 | h.p1_b2 | h.p2_b1 | h.p2_b2 | h.p3_b1 | h.p3_b2 | h.p4_b1 | h.p4_b2 | h.p5_b1 | h.p5_b2;
-    PixelDesignator fill_bits;
+    PixelBits fill_bits;
     fill_bits.r_bit = GetGpioFromLedSequence('R', led_sequence, r, g, b);
     fill_bits.g_bit = GetGpioFromLedSequence('G', led_sequence, r, g, b);
     fill_bits.b_bit = GetGpioFromLedSequence('B', led_sequence, r, g, b);
 
+    if ((size_t)double_rows_ * columns_ * kBitPlanes
+        > PixelDesignator::kMaxGpioWord + 1) {
+      fprintf(stderr, "Display too large: %d columns.\n", columns_);
+      abort();
+    }
     *shared_mapper_ = new PixelDesignatorMap(columns_, height_, fill_bits);
     for (int y = 0; y < height_; ++y) {
       for (int x = 0; x < columns_; ++x) {
-        InitDefaultDesignator(x, y, led_sequence, (*shared_mapper_)->get(x, y));
+        InitDefaultDesignator(x, y, (*shared_mapper_)->get(x, y));
       }
     }
   }
@@ -453,6 +496,9 @@ Framebuffer::~Framebuffer() {
   const gpio_bits_t result = io->InitOutputs(all_used_bits,
                                              is_some_adafruit_hat);
   assert(result == all_used_bits);  // Impl: all bits declared in gpio.cc ?
+  if (io->emulation()) {
+    io->emulation()->SetSignalBits(h.clock, h.strobe);
+  }
 
   std::vector<int> bitplane_timings;
   uint32_t timing_ns = pwm_lsb_nanoseconds;
@@ -579,7 +625,33 @@ inline gpio_bits_t *Framebuffer::ValueAt(int double_row, int column, int bit) {
                             + column ];
 }
 
+template <typename Run>
+inline void Framebuffer::ForEachMatrixRun(const PixelTransform &t,
+                                          int x, int y, int length,
+                                          uint64_t *touched_rows, Run run) {
+  int matrix_x = t.xx * x + t.xy * y + t.x0;
+  int matrix_y = t.yx * x + t.yy * y + t.y0;
+  // Walking along a matrix row stays in one double-row. Walking along a
+  // column, the bits change and the position wraps at the double-rows.
+  const int step = t.xx + t.yx * row_words_;
+  while (length > 0) {
+    const int double_row = matrix_y % double_rows_;
+    int count = length;
+    if (t.yx > 0) count = std::min(count, double_rows_ - double_row);
+    if (t.yx < 0) count = std::min(count, double_row + 1);
+    const int last_double_row = double_row + t.yx * (count - 1);
+    const int low = std::min(double_row, last_double_row);
+    const int high = std::max(double_row, last_double_row);
+    *touched_rows |= ((2ull << high) - 1) & ~((1ull << low) - 1);
+    run(double_row * row_words_ + matrix_x, step, count, row_bits_[matrix_y]);
+    matrix_x += t.xx * count;
+    matrix_y += t.yx * count;
+    length -= count;
+  }
+}
+
 void Framebuffer::Clear() {
+  MarkDirty(AllRows());
   if (inverse_color_) {
     Fill(0, 0, 0);
   } else  {
@@ -590,31 +662,14 @@ void Framebuffer::Clear() {
 }
 
 // Do CIE1931 luminance correction and scale to output bitplanes
-static uint16_t luminance_cie1931(uint8_t c, uint8_t brightness) {
+static uint16_t luminance_cie1931(float c, uint8_t brightness) {
   float out_factor = ((1 << internal::Framebuffer::kBitPlanes) - 1);
   float v = (float) c * brightness / 255.0;
   return roundf(out_factor * ((v <= 8) ? v / 902.3 : pow((v + 16) / 116.0, 3)));
 }
 
-struct ColorLookup {
-  uint16_t color[256];
-};
-static ColorLookup *CreateLuminanceCIE1931LookupTable() {
-  ColorLookup *for_brightness = new ColorLookup[100];
-  for (int c = 0; c < 256; ++c)
-    for (int b = 0; b < 100; ++b)
-      for_brightness[b].color[c] = luminance_cie1931(c, b + 1);
-
-  return for_brightness;
-}
-
-static inline uint16_t CIEMapColor(uint8_t brightness, uint8_t c) {
-  static ColorLookup *luminance_lookup = CreateLuminanceCIE1931LookupTable();
-  return luminance_lookup[brightness - 1].color[c];
-}
-
 // Non luminance correction. TODO: consider getting rid of this.
-static inline uint16_t DirectMapColor(uint8_t brightness, uint8_t c) {
+static uint16_t DirectMapColor(uint8_t brightness, uint8_t c) {
   // simple scale down the color value
   c = c * brightness / 100;
 
@@ -623,31 +678,54 @@ static inline uint16_t DirectMapColor(uint8_t brightness, uint8_t c) {
   return (shift > 0) ? (c << shift) : (c >> -shift);
 }
 
+void Framebuffer::UpdateColorLookup() {
+  for (int channel = 0; channel < 3; ++channel) {
+    const uint8_t white = calibration_.white[channel];
+    const float gamma = calibration_.gamma[channel];
+    const bool calibrated = (white != 255 || gamma != 1.0f);
+    for (int c = 0; c < 256; ++c) {
+      const float value = calibrated ? white * powf(c / 255.0f, gamma) : c;
+      uint16_t bits = do_luminance_correct_
+        ? luminance_cie1931(value, brightness_)
+        : DirectMapColor(brightness_, lroundf(value));
+      if (inverse_color_) bits = ~bits;
+      color_lookup_[channel][c] = bits;
+    }
+  }
+  cached_planes_key_ = ~0u;
+}
+
+void Framebuffer::set_luminance_correct(bool on) {
+  if (on == do_luminance_correct_) return;
+  do_luminance_correct_ = on;
+  UpdateColorLookup();
+}
+
+void Framebuffer::SetBrightness(uint8_t b) {
+  b = (b <= 100 ? (b != 0 ? b : 1) : 100);
+  if (b == brightness_) return;
+  brightness_ = b;
+  UpdateColorLookup();
+}
+
+void Framebuffer::SetColorCalibration(const ColorCalibration &calibration) {
+  calibration_ = calibration;
+  UpdateColorLookup();
+}
+
 inline void Framebuffer::MapColors(
   uint8_t r, uint8_t g, uint8_t b,
   uint16_t *red, uint16_t *green, uint16_t *blue) {
-
-  if (do_luminance_correct_) {
-    *red   = CIEMapColor(brightness_, r);
-    *green = CIEMapColor(brightness_, g);
-    *blue  = CIEMapColor(brightness_, b);
-  } else {
-    *red   = DirectMapColor(brightness_, r);
-    *green = DirectMapColor(brightness_, g);
-    *blue  = DirectMapColor(brightness_, b);
-  }
-
-  if (inverse_color_) {
-    *red = ~(*red);
-    *green = ~(*green);
-    *blue = ~(*blue);
-  }
+  *red   = color_lookup_[0][r];
+  *green = color_lookup_[1][g];
+  *blue  = color_lookup_[2][b];
 }
 
 void Framebuffer::Fill(uint8_t r, uint8_t g, uint8_t b) {
   uint16_t red, green, blue;
   MapColors(r, g, b, &red, &green, &blue);
-  const PixelDesignator &fill = (*shared_mapper_)->GetFillColorBits();
+  const PixelBits &fill = (*shared_mapper_)->GetFillColorBits();
+  MarkDirty(AllRows());
 
   for (int bits = kBitPlanes - pwm_bits_; bits < kBitPlanes; ++bits) {
     uint16_t mask = 1 << bits;
@@ -669,21 +747,24 @@ int Framebuffer::width() const { return (*shared_mapper_)->width(); }
 int Framebuffer::height() const { return (*shared_mapper_)->height(); }
 
 void Framebuffer::SetPixel(int x, int y, uint8_t r, uint8_t g, uint8_t b) {
-  const PixelDesignator *designator = (*shared_mapper_)->get(x, y);
+  PixelDesignatorMap *const map = *shared_mapper_;
+  const PixelDesignator *designator = map->get(x, y);
   if (designator == NULL) return;
-  const long pos = designator->gpio_word;
-  if (pos < 0) return;  // non-used pixel marker.
+  if (designator->unused()) return;
+  const uint32_t pos = designator->gpio_word;
 
   uint16_t red, green, blue;
   MapColors(r, g, b, &red, &green, &blue);
+  MarkDirty(1ull << (pos / row_words_));
 
   gpio_bits_t *bits = bitplane_buffer_ + pos;
   const int min_bit_plane = kBitPlanes - pwm_bits_;
   bits += (columns_ * min_bit_plane);
-  const gpio_bits_t r_bits = designator->r_bit;
-  const gpio_bits_t g_bits = designator->g_bit;
-  const gpio_bits_t b_bits = designator->b_bit;
-  const gpio_bits_t designator_mask = designator->mask;
+  const PixelBits &pixel_bits = map->bits(*designator);
+  const gpio_bits_t r_bits = pixel_bits.r_bit;
+  const gpio_bits_t g_bits = pixel_bits.g_bit;
+  const gpio_bits_t b_bits = pixel_bits.b_bit;
+  const gpio_bits_t designator_mask = pixel_bits.mask;
   for (uint16_t mask = 1<<min_bit_plane; mask != 1<<kBitPlanes; mask <<=1 ) {
     gpio_bits_t color_bits = 0;
     if (red & mask)   color_bits |= r_bits;
@@ -695,13 +776,327 @@ void Framebuffer::SetPixel(int x, int y, uint8_t r, uint8_t g, uint8_t b) {
 }
 
 void Framebuffer::SetPixels(int x, int y, int width, int height, Color *colors) {
-  for (int iy = 0; iy < height; ++iy) {
-    for (int ix = 0; ix < width; ++ix) {
-      SetPixel(x + ix, y + iy, colors->r, colors->g, colors->b);
-      ++colors;
+  static_assert(sizeof(Color) == 3, "Color expected to be packed RGB");
+  SetPixelsFromBuffer(x, y, width, height,
+                      reinterpret_cast<const uint8_t*>(colors), 3 * width,
+                      false);
+}
+
+void Framebuffer::SetPixelsFromBuffer(int x, int y, int width, int height,
+                                      const uint8_t *buffer, size_t stride,
+                                      bool is_bgr) {
+  PixelDesignatorMap *const map = *shared_mapper_;
+  if (x < 0) { buffer += 3 * -x; width += x; x = 0; }
+  if (y < 0) { buffer += stride * -y; height += y; y = 0; }
+  if (x + width > map->width()) width = map->width() - x;
+  if (y + height > map->height()) height = map->height() - y;
+  if (width <= 0 || height <= 0) return;
+
+  const int r_offset = is_bgr ? 2 : 0;
+  const int b_offset = is_bgr ? 0 : 2;
+  const int min_bit_plane = kBitPlanes - pwm_bits_;
+
+  // Images mostly consist of runs of the same color, so only map on change.
+  uint32_t last_rgb = ~0u;
+  uint16_t red = 0, green = 0, blue = 0;
+  auto set_pixel = [&](const uint8_t *pixel, uint32_t pos,
+                       const PixelBits &pixel_bits) {
+    const uint32_t rgb = (pixel[r_offset] << 16) | (pixel[1] << 8)
+      | pixel[b_offset];
+    if (rgb != last_rgb) {
+      MapColors(pixel[r_offset], pixel[1], pixel[b_offset],
+                &red, &green, &blue);
+      last_rgb = rgb;
+    }
+    gpio_bits_t *bits = bitplane_buffer_ + pos + columns_ * min_bit_plane;
+    for (int plane = min_bit_plane; plane < kBitPlanes; ++plane) {
+      // Without branches: spread the bit of each color to a full mask.
+      const gpio_bits_t color_bits
+        = (pixel_bits.r_bit & -(gpio_bits_t)((red >> plane) & 1))
+        | (pixel_bits.g_bit & -(gpio_bits_t)((green >> plane) & 1))
+        | (pixel_bits.b_bit & -(gpio_bits_t)((blue >> plane) & 1));
+      *bits = (*bits & pixel_bits.mask) | color_bits;
+      bits += columns_;
     }
+  };
+
+  uint64_t touched_rows = 0;
+  const PixelTransform *transform = map->transform();
+  for (int row = 0; row < height; ++row) {
+    const uint8_t *pixel = buffer + row * stride;
+    if (transform != NULL) {
+      ForEachMatrixRun(*transform, x, y + row, width, &touched_rows,
+                       [&](int pos, int step, int count, const PixelBits &pb) {
+          for (int i = 0; i < count; ++i, pixel += 3, pos += step) {
+            set_pixel(pixel, pos, pb);
+          }
+        });
+      continue;
+    }
+    const PixelDesignator *designator = map->get(x, y + row);
+    for (int col = 0; col < width; ++col, pixel += 3, ++designator) {
+      if (designator->unused()) continue;  // non-used pixel marker.
+      touched_rows |= 1ull << (designator->gpio_word / row_words_);
+      set_pixel(pixel, designator->gpio_word, map->bits(*designator));
+    }
+  }
+  MarkDirty(touched_rows);
+}
+void Framebuffer::MapPlaneColors(uint8_t r, uint8_t g, uint8_t b,
+                                 PlaneColor *planes) {
+  uint16_t red, green, blue;
+  MapColors(r, g, b, &red, &green, &blue);
+  for (int plane = kBitPlanes - pwm_bits_; plane < kBitPlanes; ++plane) {
+    planes[plane].r = -(gpio_bits_t)((red >> plane) & 1);
+    planes[plane].g = -(gpio_bits_t)((green >> plane) & 1);
+    planes[plane].b = -(gpio_bits_t)((blue >> plane) & 1);
+  }
+}
+
+inline const Framebuffer::PlaneColor *
+Framebuffer::CachedPlaneColors(uint8_t r, uint8_t g, uint8_t b) {
+  const uint32_t key = (pwm_bits_ << 24) | (r << 16) | (g << 8) | b;
+  if (key != cached_planes_key_) {
+    MapPlaneColors(r, g, b, cached_planes_);
+    cached_planes_key_ = key;
+  }
+  return cached_planes_;
+}
+
+inline void Framebuffer::SetMappedPixel(int x, int y, const PlaneColor *planes,
+                                        uint64_t *touched_rows) {
+  PixelDesignatorMap *const map = *shared_mapper_;
+  const PixelDesignator *designator = map->get(x, y);
+  if (designator == NULL) return;
+  if (designator->unused()) return;
+  const uint32_t pos = designator->gpio_word;
+  *touched_rows |= 1ull << (pos / row_words_);
+
+  const int min_bit_plane = kBitPlanes - pwm_bits_;
+  gpio_bits_t *bits = bitplane_buffer_ + pos + columns_ * min_bit_plane;
+  const PixelBits &pixel_bits = map->bits(*designator);
+  const gpio_bits_t r_bits = pixel_bits.r_bit;
+  const gpio_bits_t g_bits = pixel_bits.g_bit;
+  const gpio_bits_t b_bits = pixel_bits.b_bit;
+  const gpio_bits_t designator_mask = pixel_bits.mask;
+  for (int plane = min_bit_plane; plane < kBitPlanes; ++plane) {
+    const gpio_bits_t color_bits = (r_bits & planes[plane].r)
+      | (g_bits & planes[plane].g) | (b_bits & planes[plane].b);
+    *bits = (*bits & designator_mask) | color_bits;
+    bits += columns_;
   }
 }
+
+void Framebuffer::DrawLine(int x0, int y0, int x1, int y1, int thickness,
+                           uint8_t r, uint8_t g, uint8_t b) {
+  PlaneColor planes[kBitPlanes];
+  MapPlaneColors(r, g, b, planes);
+  uint64_t touched_rows = 0;
+  TraceThickLine(x0, y0, x1, y1, thickness, [&](int x, int y) {
+      SetMappedPixel(x, y, planes, &touched_rows);
+    });
+  MarkDirty(touched_rows);
+}
+
+void Framebuffer::DrawCircle(int x0, int y0, int radius,
+                             uint8_t r, uint8_t g, uint8_t b) {
+  PlaneColor planes[kBitPlanes];
+  MapPlaneColors(r, g, b, planes);
+  uint64_t touched_rows = 0;
+  TraceCircle(x0, y0, radius, [&](int x, int y) {
+      SetMappedPixel(x, y, planes, &touched_rows);
+    });
+  MarkDirty(touched_rows);
+}
+
+void Framebuffer::FillRectangle(int x, int y, int width, int height,
+                                uint8_t r, uint8_t g, uint8_t b) {
+  PixelDesignatorMap *const map = *shared_mapper_;
+  if (x < 0) { width += x; x = 0; }
+  if (y < 0) { height += y; y = 0; }
+  if (x + width > map->width()) width = map->width() - x;
+  if (y + height > map->height()) height = map->height() - y;
+  if (width <= 0 || height <= 0) return;
+
+  const PlaneColor *const planes = CachedPlaneColors(r, g, b);
+  uint64_t touched_rows = 0;
+  const PixelTransform *t = map->transform();
+  if (t != NULL) {
+    // Rotated or mirrored, this is still a rectangle on the matrix, so fill
+    // that in bitplane order.
+    const int x1 = x + width - 1, y1 = y + height - 1;
+    const int corner_x[2] = { t->xx * x + t->xy * y + t->x0,
+                              t->xx * x1 + t->xy * y1 + t->x0 };
+    const int corner_y[2] = { t->yx * x + t->yy * y + t->y0,
+                              t->yx * x1 + t->yy * y1 + t->y0 };
+    const int left = std::min(corner_x[0], corner_x[1]);
+    const int count = std::max(corner_x[0], corner_x[1]) - left + 1;
+    const int top = std::min(corner_y[0], corner_y[1]);
+    const int bottom = std::max(corner_y[0], corner_y[1]);
+    // A rotated run of text is a column on the matrix, so the double-row
+    // and its position are stepped along instead of computed for each row.
+    const int min_plane = kBitPlanes - pwm_bits_;
+    int double_row = top % double_rows_;
+    gpio_bits_t *row_start = ValueAt(double_row, left, min_plane);
+    for (int matrix_y = top; matrix_y <= bottom; ++matrix_y) {
+      const PixelBits &pb = row_bits_[matrix_y];
+      touched_rows |= 1ull << double_row;
+      gpio_bits_t *plane_bits = row_start;
+      for (int plane = min_plane; plane < kBitPlanes; ++plane) {
+        const gpio_bits_t color_bits = (pb.r_bit & planes[plane].r)
+          | (pb.g_bit & planes[plane].g) | (pb.b_bit & planes[plane].b);
+        if (count == 1) {
+          *plane_bits = (*plane_bits & pb.mask) | color_bits;
+        } else {
+          gpio_bits_t *bits = plane_bits;
+          for (int i = 0; i < count; ++i, ++bits) {
+            *bits = (*bits & pb.mask) | color_bits;
+          }
+        }
+        plane_bits += columns_;
+      }
+      if (++double_row == double_rows_) {
+        double_row = 0;
+        row_start = ValueAt(0, left, min_plane);
+      } else {
+        row_start += row_words_;
+      }
+    }
+    MarkDirty(touched_rows);
+    return;
+  }
+  for (int row = y; row < y + height; ++row) {
+    for (int col = x; col < x + width; ++col) {
+      SetMappedPixel(col, row, planes, &touched_rows);
+    }
+  }
+  MarkDirty(touched_rows);
+}
+
+void Framebuffer::Draw(DrawList *list) {
+  if (list->has_fill_) {
+    const Color &c = list->fill_color_;
+    Fill(c.r, c.g, c.b);
+  }
+  // These are underneath everything else.
+  for (size_t i = 0; i < list->base_rects_.size(); ++i) {
+    const DrawList::Rect &rect = list->base_rects_[i];
+    const Color &c = list->colors_[rect.color];
+    FillRectangle(rect.x, rect.y, rect.width, rect.height, c.r, c.g, c.b);
+  }
+  const std::vector<DrawList::Span> &spans = list->spans_;
+  if (spans.empty()) return;
+
+  // Map each color once.
+  mapped_colors_.resize(list->colors_.size() * kBitPlanes);
+  for (size_t i = 0; i < list->colors_.size(); ++i) {
+    const Color &c = list->colors_[i];
+    MapPlaneColors(c.r, c.g, c.b, &mapped_colors_[i * kBitPlanes]);
+  }
+
+  // Pixels in the fill color don't need to be written: whatever is
+  // underneath them is either covered by them or already has that color,
+  // as there are no base rectangles after a Fill().
+  int fill_color = -1;
+  uint32_t fill_rgb = ~0u;
+  if (list->has_fill_) {
+    const Color &c = list->fill_color_;
+    fill_rgb = (c.r << 16) | (c.g << 8) | c.b;
+    for (size_t i = 0; i < list->colors_.size(); ++i) {
+      const Color &l = list->colors_[i];
+      if (l.r == c.r && l.g == c.g && l.b == c.b) fill_color = i;
+    }
+  }
+
+  // Bucket the spans by row, keeping the recording order within a row.
+  PixelDesignatorMap *const map = *shared_mapper_;
+  const int width = map->width();
+  const int height = map->height();
+  std::vector<uint32_t> &by_row = list->by_row_;
+  std::vector<uint32_t> &row_end = list->row_end_;
+  row_end.assign(height + 1, 0);
+  for (size_t i = 0; i < spans.size(); ++i) {
+    if (spans[i].y < height) ++row_end[spans[i].y + 1];
+  }
+  for (int y = 0; y < height; ++y) row_end[y + 1] += row_end[y];
+  by_row.resize(row_end[height]);
+  for (size_t i = 0; i < spans.size(); ++i) {
+    if (spans[i].y < height) by_row[row_end[spans[i].y]++] = i;
+  }
+  // Now row_end[y] is where row y ends, and row y - 1 ended where it starts.
+
+  std::vector<uint64_t> &covered = list->covered_;
+  covered.resize((width + 63) / 64);
+  const int min_bit_plane = kBitPlanes - pwm_bits_;
+  PlaneColor image_planes[kBitPlanes];
+  uint32_t last_rgb = ~0u;
+  uint64_t touched_rows = 0;
+  for (int y = 0; y < height; ++y) {
+    const uint32_t begin = (y == 0) ? 0 : row_end[y - 1];
+    if (begin == row_end[y]) continue;
+    std::fill(covered.begin(), covered.end(), 0);
+
+    // Topmost span first: each pixel is only written by the first span
+    // covering it.
+    for (uint32_t i = row_end[y]; i > begin; --i) {
+      const DrawList::Span &span = spans[by_row[i - 1]];
+      if (span.x >= width) continue;
+      const int end = std::min(span.x + span.length, width);
+      const PixelDesignator *designator = map->get(span.x, y);
+      const PlaneColor *const planes = span.pixels != NULL
+        ? image_planes : &mapped_colors_[span.color * kBitPlanes];
+      const bool fill_colored = span.pixels == NULL
+        && span.color == fill_color;
+
+      // The bits to set per plane only change with the color or with the
+      // color bits of the designator, so usually once per span.
+      gpio_bits_t plane_bits[kBitPlanes];
+      int plane_bits_for = -1;
+      for (int x = span.x; x < end; ++x, ++designator) {
+        uint64_t &covered_word = covered[x / 64];
+        const uint64_t covered_bit = 1ull << (x % 64);
+        if (covered_word & covered_bit) continue;
+        covered_word |= covered_bit;
+        if (fill_colored) continue;
+        if (designator->unused()) continue;
+        const uint32_t pos = designator->gpio_word;
+
+        if (span.pixels != NULL) {
+          // Image rows: only map on color change.
+          const uint8_t *pixel = span.pixels + 3 * (x - span.x);
+          const uint8_t r = pixel[span.is_bgr ? 2 : 0];
+          const uint8_t b = pixel[span.is_bgr ? 0 : 2];
+          const uint32_t rgb = (r << 16) | (pixel[1] << 8) | b;
+          if (rgb == fill_rgb) continue;
+          if (rgb != last_rgb) {
+            MapPlaneColors(r, pixel[1], b, image_planes);
+            last_rgb = rgb;
+            plane_bits_for = -1;
+          }
+        }
+        const PixelBits &pixel_bits = map->bits(*designator);
+        if (plane_bits_for != (int)designator->bits) {
+          for (int plane = min_bit_plane; plane < kBitPlanes; ++plane) {
+            plane_bits[plane] = (pixel_bits.r_bit & planes[plane].r)
+              | (pixel_bits.g_bit & planes[plane].g)
+              | (pixel_bits.b_bit & planes[plane].b);
+          }
+          plane_bits_for = designator->bits;
+        }
+
+        touched_rows |= 1ull << (pos / row_words_);
+        gpio_bits_t *bits = bitplane_buffer_ + pos + columns_ * min_bit_plane;
+        const gpio_bits_t designator_mask = pixel_bits.mask;
+        for (int plane = min_bit_plane; plane < kBitPlanes; ++plane) {
+          *bits = (*bits & designator_mask) | plane_bits[plane];
+          bits += columns_;
+        }
+      }
+    }
+  }
+  MarkDirty(touched_rows);
+}
+
 // Strange LED-mappings such as RBG or so are handled here.
 gpio_bits_t Framebuffer::GetGpioFromLedSequence(char col,
                                                 const char *led_sequence,
@@ -723,81 +1118,85 @@ gpio_bits_t Framebuffer::GetGpioFromLedSequence(char col,
   return default_r;  // String too long, should've been caught earlier.
 }
 
-void Framebuffer::InitDefaultDesignator(int x, int y, const char *seq,
-                                        PixelDesignator *d) {
+PixelBits Framebuffer::DefaultPixelBits(int y, const char *seq) {
   const struct HardwareMapping &h = *hardware_mapping_;
-  gpio_bits_t *bits = ValueAt(y % double_rows_, x, 0);
-  d->gpio_word = bits - bitplane_buffer_;
-  d->r_bit = d->g_bit = d->b_bit = 0;
+  PixelBits d;
   if (y < rows_) {
     if (y < double_rows_) {
-      d->r_bit = GetGpioFromLedSequence('R', seq, h.p0_r1, h.p0_g1, h.p0_b1);
-      d->g_bit = GetGpioFromLedSequence('G', seq, h.p0_r1, h.p0_g1, h.p0_b1);
-      d->b_bit = GetGpioFromLedSequence('B', seq, h.p0_r1, h.p0_g1, h.p0_b1);
+      d.r_bit = GetGpioFromLedSequence('R', seq, h.p0_r1, h.p0_g1, h.p0_b1);
+      d.g_bit = GetGpioFromLedSequence('G', seq, h.p0_r1, h.p0_g1, h.p0_b1);
+      d.b_bit = GetGpioFromLedSequence('B', seq, h.p0_r1, h.p0_g1, h.p0_b1);
     } else {
-      d->r_bit = GetGpioFromLedSequence('R', seq, h.p0_r2, h.p0_g2, h.p0_b2);
-      d->g_bit = GetGpioFromLedSequence('G', seq, h.p0_r2, h.p0_g2, h.p0_b2);
-      d->b_bit = GetGpioFromLedSequence('B', seq, h.p0_r2, h.p0_g2, h.p0_b2);
+      d.r_bit = GetGpioFromLedSequence('R', seq, h.p0_r2, h.p0_g2, h.p0_b2);
+      d.g_bit = GetGpioFromLedSequence('G', seq, h.p0_r2, h.p0_g2, h.p0_b2);
+      d.b_bit = GetGpioFromLedSequence('B', seq, h.p0_r2, h.p0_g2, h.p0_b2);
     }
   }
   else if (y >= rows_ && y < 2 * rows_) {
     if (y - rows_ < double_rows_) {
-      d->r_bit = GetGpioFromLedSequence('R', seq, h.p1_r1, h.p1_g1, h.p1_b1);
-      d->g_bit = GetGpioFromLedSequence('G', seq, h.p1_r1, h.p1_g1, h.p1_b1);
-      d->b_bit = GetGpioFromLedSequence('B', seq, h.p1_r1, h.p1_g1, h.p1_b1);
+      d.r_bit = GetGpioFromLedSequence('R', seq, h.p1_r1, h.p1_g1, h.p1_b1);
+      d.g_bit = GetGpioFromLedSequence('G', seq, h.p1_r1, h.p1_g1, h.p1_b1);
+      d.b_bit = GetGpioFromLedSequence('B', seq, h.p1_r1, h.p1_g1, h.p1_b1);
     } else {
-      d->r_bit = GetGpioFromLedSequence('R', seq, h.p1_r2, h.p1_g2, h.p1_b2);
-      d->g_bit = GetGpioFromLedSequence('G', seq, h.p1_r2, h.p1_g2, h.p1_b2);
-      d->b_bit = GetGpioFromLedSequence('B', seq, h.p1_r2, h.p1_g2, h.p1_b2);
+      d.r_bit = GetGpioFromLedSequence('R', seq, h.p1_r2, h.p1_g2, h.p1_b2);
+      d.g_bit = GetGpioFromLedSequence('G', seq, h.p1_r2, h.p1_g2, h.p1_b2);
+      d.b_bit = GetGpioFromLedSequence('B', seq, h.p1_r2, h.p1_g2, h.p1_b2);
     }
   }
   else if (y >= 2*rows_ && y < 3 * rows_) {
     if (y - 2*rows_ < double_rows_) {
-      d->r_bit = GetGpioFromLedSequence('R', seq, h.p2_r1, h.p2_g1, h.p2_b1);
-      d->g_bit = GetGpioFromLedSequence('G', seq, h.p2_r1, h.p2_g1, h.p2_b1);
-      d->b_bit = GetGpioFromLedSequence('B', seq, h.p2_r1, h.p2_g1, h.p2_b1);
+      d.r_bit = GetGpioFromLedSequence('R', seq, h.p2_r1, h.p2_g1, h.p2_b1);
+      d.g_bit = GetGpioFromLedSequence('G', seq, h.p2_r1, h.p2_g1, h.p2_b1);
+      d.b_bit = GetGpioFromLedSequence('B', seq, h.p2_r1, h.p2_g1, h.p2_b1);
     } else {
-      d->r_bit = GetGpioFromLedSequence('R', seq, h.p2_r2, h.p2_g2, h.p2_b2);
-      d->g_bit = GetGpioFromLedSequence('G', seq, h.p2_r2, h.p2_g2, h.p2_b2);
-      d->b_bit = GetGpioFromLedSequence('B', seq, h.p2_r2, h.p2_g2, h.p2_b2);
+      d.r_bit = GetGpioFromLedSequence('R', seq, h.p2_r2, h.p2_g2, h.p2_b2);
+      d.g_bit = GetGpioFromLedSequence('G', seq, h.p2_r2, h.p2_g2, h.p2_b2);
+      d.b_bit = GetGpioFromLedSequence('B', seq, h.p2_r2, h.p2_g2, h.p2_b2);
     }
   }
   else if (y >= 3*rows_ && y < 4 * rows_) {
     if (y - 3*rows_ < double_rows_) {
-      d->r_bit = GetGpioFromLedSequence('R', seq, h.p3_r1, h.p3_g1, h.p3_b1);
-      d->g_bit = GetGpioFromLedSequence('G', seq, h.p3_r1, h.p3_g1, h.p3_b1);
-      d->b_bit = GetGpioFromLedSequence('B', seq, h.p3_r1, h.p3_g1, h.p3_b1);
+      d.r_bit = GetGpioFromLedSequence('R', seq, h.p3_r1, h.p3_g1, h.p3_b1);
+      d.g_bit = GetGpioFromLedSequence('G', seq, h.p3_r1, h.p3_g1, h.p3_b1);
+      d.b_bit = GetGpioFromLedSequence('B', seq, h.p3_r1, h.p3_g1, h.p3_b1);
     } else {
-      d->r_bit = GetGpioFromLedSequence('R', seq, h.p3_r2, h.p3_g2, h.p3_b2);
-      d->g_bit = GetGpioFromLedSequence('G', seq, h.p3_r2, h.p3_g2, h.p3_b2);
-      d->b_bit = GetGpioFromLedSequence('B', seq, h.p3_r2, h.p3_g2, h.p3_b2);
+      d.r_bit = GetGpioFromLedSequence('R', seq, h.p3_r2, h.p3_g2, h.p3_b2);
+      d.g_bit = GetGpioFromLedSequence('G', seq, h.p3_r2, h.p3_g2, h.p3_b2);
+      d.b_bit = GetGpioFromLedSequence('B', seq, h.p3_r2, h.p3_g2, h.p3_b2);
     }
   }
   else if (y >= 4*rows_ && y < 5 * rows_){
     if (y - 4*rows_ < double_rows_) {
-      d->r_bit = GetGpioFromLedSequence('R', seq, h.p4_r1, h.p4_g1, h.p4_b1);
-      d->g_bit = GetGpioFromLedSequence('G', seq, h.p4_r1, h.p4_g1, h.p4_b1);
-      d->b_bit = GetGpioFromLedSequence('B', seq, h.p4_r1, h.p4_g1, h.p4_b1);
+      d.r_bit = GetGpioFromLedSequence('R', seq, h.p4_r1, h.p4_g1, h.p4_b1);
+      d.g_bit = GetGpioFromLedSequence('G', seq, h.p4_r1, h.p4_g1, h.p4_b1);
+      d.b_bit = GetGpioFromLedSequence('B', seq, h.p4_r1, h.p4_g1, h.p4_b1);
     } else {
-      d->r_bit = GetGpioFromLedSequence('R', seq, h.p4_r2, h.p4_g2, h.p4_b2);
-      d->g_bit = GetGpioFromLedSequence('G', seq, h.p4_r2, h.p4_g2, h.p4_b2);
-      d->b_bit = GetGpioFromLedSequence('B', seq, h.p4_r2, h.p4_g2, h.p4_b2);
+      d.r_bit = GetGpioFromLedSequence('R', seq, h.p4_r2, h.p4_g2, h.p4_b2);
+      d.g_bit = GetGpioFromLedSequence('G', seq, h.p4_r2, h.p4_g2, h.p4_b2);
+      d.b_bit = GetGpioFromLedSequence('B', seq, h.p4_r2, h.p4_g2, h.p4_b2);
     }
 
   }
   else {
     if (y - 5*rows_ < double_rows_) {
-      d->r_bit = GetGpioFromLedSequence('R', seq, h.p5_r1, h.p5_g1, h.p5_b1);
-      d->g_bit = GetGpioFromLedSequence('G', seq, h.p5_r1, h.p5_g1, h.p5_b1);
-      d->b_bit = GetGpioFromLedSequence('B', seq, h.p5_r1, h.p5_g1, h.p5_b1);
+      d.r_bit = GetGpioFromLedSequence('R', seq, h.p5_r1, h.p5_g1, h.p5_b1);
+      d.g_bit = GetGpioFromLedSequence('G', seq, h.p5_r1, h.p5_g1, h.p5_b1);
+      d.b_bit = GetGpioFromLedSequence('B', seq, h.p5_r1, h.p5_g1, h.p5_b1);
     } else {
-      d->r_bit = GetGpioFromLedSequence('R', seq, h.p5_r2, h.p5_g2, h.p5_b2);
-      d->g_bit = GetGpioFromLedSequence('G', seq, h.p5_r2, h.p5_g2, h.p5_b2);
-      d->b_bit = GetGpioFromLedSequence('B', seq, h.p5_r2, h.p5_g2, h.p5_b2);
+      d.r_bit = GetGpioFromLedSequence('R', seq, h.p5_r2, h.p5_g2, h.p5_b2);
+      d.g_bit = GetGpioFromLedSequence('G', seq, h.p5_r2, h.p5_g2, h.p5_b2);
+      d.b_bit = GetGpioFromLedSequence('B', seq, h.p5_r2, h.p5_g2, h.p5_b2);
     }
   }
 
-  d->mask = ~(d->r_bit | d->g_bit | d->b_bit);
+  d.mask = ~(d.r_bit | d.g_bit | d.b_bit);
+  return d;
+}
+
+void Framebuffer::InitDefaultDesignator(int x, int y,
+                                        PixelDesignator *designator) {
+  designator->gpio_word = ValueAt(y % double_rows_, x, 0) - bitplane_buffer_;
+  designator->bits = (*shared_mapper_)->AddBits(row_bits_[y]);
 }
 
 void Framebuffer::Serialize(const char **data, size_t *len) const {
@@ -807,70 +1206,138 @@ void Framebuffer::Serialize(const char **data, size_t *len) const {
 
 bool Framebuffer::Deserialize(const char *data, size_t len) {
   if (len != buffer_size_) return false;
+  MarkDirty(AllRows());
   memcpy(bitplane_buffer_, data, len);
   return true;
 }
 
 void Framebuffer::CopyFrom(const Framebuffer *other) {
   if (other == this) return;
+  MarkDirty(AllRows());
   memcpy(bitplane_buffer_, other->bitplane_buffer_, buffer_size_);
 }
 
-void Framebuffer::DumpToMatrix(GPIO *io, int pwm_low_bit) {
+void Framebuffer::CopyRowsFrom(const Framebuffer *other, uint64_t rows) {
+  if (other == this) return;
+  rows &= AllRows();
+  const size_t row_bytes = row_words_ * sizeof(gpio_bits_t);
+  for (int d = 0; rows != 0; ++d, rows >>= 1) {
+    if ((rows & 1) == 0) continue;
+    memcpy(ValueAt(d, 0, 0), other->bitplane_buffer_ + d * row_words_,
+           row_bytes);
+    MarkDirty(1ull << d);
+  }
+}
+
+uint64_t Framebuffer::DiffRows(const Framebuffer *other) const {
+  const size_t row_bytes = row_words_ * sizeof(gpio_bits_t);
+  uint64_t result = 0;
+  for (int d = 0; d < double_rows_; ++d) {
+    if (memcmp(bitplane_buffer_ + d * row_words_,
+               other->bitplane_buffer_ + d * row_words_, row_bytes) != 0) {
+      result |= 1ull << d;
+    }
+  }
+  return result;
+}
+
+void Framebuffer::SerializeRow(int double_row,
+                               const char **data, size_t *len) const {
+  assert(double_row >= 0 && double_row < double_rows_);
+  *data = reinterpret_cast<const char*>(bitplane_buffer_
+                                        + double_row * row_words_);
+  *len = row_words_ * sizeof(gpio_bits_t);
+}
+
+bool Framebuffer::XorSerialized(size_t offset, const char *data, size_t len) {
+  if (offset % sizeof(gpio_bits_t) != 0 || len % sizeof(gpio_bits_t) != 0
+      || offset > buffer_size_ || len > buffer_size_ - offset) {
+    return false;
+  }
+  if (len == 0) return true;
+  const size_t first = offset / sizeof(gpio_bits_t);
+  const size_t count = len / sizeof(gpio_bits_t);
+  const gpio_bits_t *words = reinterpret_cast<const gpio_bits_t*>(data);
+  gpio_bits_t *bits = bitplane_buffer_ + first;
+  for (size_t i = 0; i < count; ++i) {
+    bits[i] ^= words[i];
+  }
+  const int first_row = first / row_words_;
+  const int last_row = (first + count - 1) / row_words_;
+  MarkDirty(((2ull << last_row) - 1) & ~((1ull << first_row) - 1));
+  return true;
+}
+
+/* static */ gpio_bits_t Framebuffer::ColorClockMask(int parallel) {
   const struct HardwareMapping &h = *hardware_mapping_;
   gpio_bits_t color_clk_mask = 0;  // Mask of bits while clocking in.
   color_clk_mask |= h.p0_r1 | h.p0_g1 | h.p0_b1 | h.p0_r2 | h.p0_g2 | h.p0_b2;
-  if (parallel_ >= 2) {
+  if (parallel >= 2) {
     color_clk_mask |= h.p1_r1 | h.p1_g1 | h.p1_b1 | h.p1_r2 | h.p1_g2 | h.p1_b2;
   }
-  if (parallel_ >= 3) {
+  if (parallel >= 3) {
     color_clk_mask |= h.p2_r1 | h.p2_g1 | h.p2_b1 | h.p2_r2 | h.p2_g2 | h.p2_b2;
   }
-  if (parallel_ >= 4) {
+  if (parallel >= 4) {
     color_clk_mask |= h.p3_r1 | h.p3_g1 | h.p3_b1 | h.p3_r2 | h.p3_g2 | h.p3_b2;
   }
-  if (parallel_ >= 5) {
+  if (parallel >= 5) {
     color_clk_mask |= h.p4_r1 | h.p4_g1 | h.p4_b1 | h.p4_r2 | h.p4_g2 | h.p4_b2;
   }
-  if (parallel_ >= 6) {
+  if (parallel >= 6) {
     color_clk_mask |= h.p5_r1 | h.p5_g1 | h.p5_b1 | h.p5_r2 | h.p5_g2 | h.p5_b2;
   }
 
   color_clk_mask |= h.clock;
+  return color_clk_mask;
+}
+
+inline int Framebuffer::DisplayRow(int row_loop) const {
+  switch (scan_mode_) {
+  case 0:  // progressive
+  default:
+    return row_loop;
+
+  case 1:  // interlaced
+    const int half_double = double_rows_/2;
+    return ((row_loop < half_double)
+            ? (row_loop << 1)
+            : ((row_loop - half_double) << 1) + 1);
+  }
+}
+
+void Framebuffer::DumpToMatrix(GPIO *io, int pwm_low_bit,
+                               uint32_t *oe_wait_usec) {
+  const struct HardwareMapping &h = *hardware_mapping_;
+  const gpio_bits_t color_clk_mask = color_clk_mask_;
 
   // Depending if we do dithering, we might not always show the lowest bits.
   const int start_bit = std::max(pwm_low_bit, kBitPlanes - pwm_bits_);
 
-  const uint8_t half_double = double_rows_/2;
-  for (uint8_t row_loop = 0; row_loop < double_rows_; ++row_loop) {
-    uint8_t d_row;
-    switch (scan_mode_) {
-    case 0:  // progressive
-    default:
-      d_row = row_loop;
-      break;
-
-    case 1:  // interlaced
-      d_row = ((row_loop < half_double)
-               ? (row_loop << 1)
-               : ((row_loop - half_double) << 1) + 1);
-    }
+  for (int row_loop = 0; row_loop < double_rows_; ++row_loop) {
+    const int d_row = DisplayRow(row_loop);
 
     // Rows can't be switched very quickly without ghosting, so we do the
     // full PWM of one row before switching rows.
     for (int b = start_bit; b < kBitPlanes; ++b) {
-      gpio_bits_t *row_data = ValueAt(d_row, 0, b);
       // While the output enable is still on, we can already clock in the next
       // data.
+      const gpio_bits_t *row_data = ValueAt(d_row, 0, b);
       for (int col = 0; col < columns_; ++col) {
         const gpio_bits_t &out = *row_data++;
         io->WriteMaskedBits(out, color_clk_mask);  // col + reset clock
-        io->SetBits(h.clock);               // Rising edge: clock color in.
+        io->SetBits(h.clock);             // Rising edge: clock color in.
       }
       io->ClearBits(color_clk_mask);    // clock back to normal.
 
       // OE of the previous row-data must be finished before strobe.
-      sOutputEnablePulser->WaitPulseFinished();
+      if (oe_wait_usec) {
+        const uint32_t wait_start_usec = GetMicrosecondCounter();
+        sOutputEnablePulser->WaitPulseFinished();
+        *oe_wait_usec += GetMicrosecondCounter() - wait_start_usec;
+      } else {
+        sOutputEnablePulser->WaitPulseFinished();
+      }
 
       // Setting address and strobing needs to happen in dark time.
       row_setter_->SetRowAddress(io, d_row);
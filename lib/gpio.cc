@@ -143,6 +143,33 @@ static bool LinuxHasModuleLoaded(const char *name) {
 
 #define GPIO_BIT(x) (1ull << x)
 
+EmulatedGPIORegisters::EmulatedGPIORegisters()
+  : level_(0), clock_(0), strobe_(0), dummy_register_(0),
+    set_writes_(0), clear_writes_(0), clock_edges_(0), strobes_(0),
+    oe_pulses_(0), oe_nanoseconds_(0) {
+}
+
+void EmulatedGPIORegisters::SetSignalBits(gpio_bits_t clock,
+                                          gpio_bits_t strobe) {
+  clock_ = clock;
+  strobe_ = strobe;
+}
+
+void EmulatedGPIORegisters::RecordPulse(long nanos) {
+  Increment(&oe_pulses_);
+  oe_nanoseconds_.store(oe_nanoseconds_.load(std::memory_order_relaxed) + nanos,
+                        std::memory_order_relaxed);
+}
+
+void EmulatedGPIORegisters::GetCounters(Counters *counters) const {
+  counters->set_writes = set_writes_.load(std::memory_order_relaxed);
+  counters->clear_writes = clear_writes_.load(std::memory_order_relaxed);
+  counters->clock_edges = clock_edges_.load(std::memory_order_relaxed);
+  counters->strobes = strobes_.load(std::memory_order_relaxed);
+  counters->oe_pulses = oe_pulses_.load(std::memory_order_relaxed);
+  counters->oe_nanoseconds = oe_nanoseconds_.load(std::memory_order_relaxed);
+}
+
 GPIO::GPIO() : output_bits_(0), input_bits_(0), reserved_bits_(0),
                slowdown_(1)
 #ifdef ENABLE_WIDE_GPIO_COMPUTE_MODULE
@@ -153,6 +180,15 @@ GPIO::GPIO() : output_bits_(0), input_bits_(0), reserved_bits_(0),
 
 gpio_bits_t GPIO::InitOutputs(gpio_bits_t outputs,
                               bool adafruit_pwm_transition_hack_needed) {
+  if (emulation_ != NULL) {
+    // No pinmux to set up, and no 1-wire to worry about.
+    outputs &= ~(output_bits_ | input_bits_ | reserved_bits_);
+#ifdef ENABLE_WIDE_GPIO_COMPUTE_MODULE
+    uses_64_bit_ |= (outputs >> 32) != 0;
+#endif
+    output_bits_ |= outputs;
+    return outputs;
+  }
   if (s_GPIO_registers == NULL) {
     fprintf(stderr, "Attempt to init outputs but not yet Init()-ialized.\n");
     return 0;
@@ -204,6 +240,11 @@ gpio_bits_t GPIO::InitOutputs(gpio_bits_t outputs,
 }
 
 gpio_bits_t GPIO::RequestInputs(gpio_bits_t inputs) {
+  if (emulation_ != NULL) {
+    inputs &= ~(output_bits_ | input_bits_ | reserved_bits_);
+    input_bits_ |= inputs;
+    return inputs;
+  }
   if (s_GPIO_registers == NULL) {
     fprintf(stderr, "Attempt to init inputs but not yet Init()-ialized.\n");
     return 0;
@@ -425,6 +466,25 @@ bool GPIO::Init(int slowdown) {
   return true;
 }
 
+bool GPIO::InitEmulated() {
+  if (emulation_ == NULL) emulation_.reset(new EmulatedGPIORegisters());
+  slowdown_ = 0;  // Nothing to wait for.
+
+  // Whatever still writes to the registers directly (e.g. delay()) ends up
+  // in a harmless dummy.
+  gpio_set_bits_low_ = emulation_->dummy_register();
+  gpio_clr_bits_low_ = emulation_->dummy_register();
+  gpio_read_bits_low_ = emulation_->dummy_register();
+
+#ifdef ENABLE_WIDE_GPIO_COMPUTE_MODULE
+  gpio_set_bits_high_ = emulation_->dummy_register();
+  gpio_clr_bits_high_ = emulation_->dummy_register();
+  gpio_read_bits_high_ = emulation_->dummy_register();
+#endif
+
+  return true;
+}
+
 bool GPIO::IsPi4() {
   return GetPiModel() == PI_MODEL_4;
 }
@@ -826,12 +886,53 @@ private:
   bool triggered_;
 };
 
+// Pin pulser for the emulated GPIO. There is no pin to toggle, but we
+// account for the pulse and keep its timing, so that refresh rates are
+// comparable to what we'd see on hardware.
+class EmulatedPinPulser : public PinPulser {
+public:
+  EmulatedPinPulser(EmulatedGPIORegisters *registers,
+                    const std::vector<int> &nano_specs)
+    : registers_(registers), nano_specs_(nano_specs),
+      end_time_nanos_(0), triggered_(false) {}
+
+  virtual void SendPulse(int time_spec_number) {
+    const long nanos = nano_specs_[time_spec_number];
+    registers_->RecordPulse(nanos);
+    end_time_nanos_ = MonotonicNanos() + nanos;
+    triggered_ = true;
+  }
+
+  virtual void WaitPulseFinished() {
+    if (!triggered_) return;
+    while (MonotonicNanos() < end_time_nanos_) {
+      // busy wait until done.
+    }
+    triggered_ = false;
+  }
+
+private:
+  static uint64_t MonotonicNanos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+  }
+
+  EmulatedGPIORegisters *const registers_;
+  const std::vector<int> nano_specs_;
+  uint64_t end_time_nanos_;
+  bool triggered_;
+};
+
 } // end anonymous namespace
 
 // Public PinPulser factory
 PinPulser *PinPulser::Create(GPIO *io, gpio_bits_t gpio_mask,
                              bool allow_hardware_pulsing,
                              const std::vector<int> &nano_wait_spec) {
+  if (io->emulation() != NULL) {
+    return new EmulatedPinPulser(io->emulation(), nano_wait_spec);
+  }
   if (!Timers::Init()) return NULL;
   if (allow_hardware_pulsing && HardwarePinPulser::CanHandle(gpio_mask)) {
     return new HardwarePinPulser(gpio_mask, nano_wait_spec);
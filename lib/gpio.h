@@ -18,6 +18,8 @@
 
 #include "gpio-bits.h"
 
+#include <atomic>
+#include <memory>
 #include <vector>
 
 #if __ARM_ARCH >= 7
@@ -29,6 +31,72 @@
 // Putting this in our namespace to not collide with other things called like
 // this.
 namespace rgb_matrix {
+// An in-memory stand-in for the GPIO registers. Instead of toggling pins,
+// it keeps the current output level and counts what is done to it, so that
+// the refresh loop can run (and be measured) on any Linux machine.
+class EmulatedGPIORegisters {
+public:
+  struct Counters {
+    uint64_t set_writes;      // Writes to the set-bits register.
+    uint64_t clear_writes;    // Writes to the clear-bits register.
+    uint64_t clock_edges;     // Rising edges on the clock line.
+    uint64_t strobes;         // Rising edges on the strobe line.
+    uint64_t oe_pulses;       // Output enable pulses sent.
+    uint64_t oe_nanoseconds;  // Sum of requested output enable pulse times.
+  };
+
+  EmulatedGPIORegisters();
+
+  // Let us know which bits carry clock and strobe, so that we can count
+  // edges on these. Output enable pulses are accounted by RecordPulse().
+  void SetSignalBits(gpio_bits_t clock, gpio_bits_t strobe);
+
+  inline void Set(gpio_bits_t value) {
+    Increment(&set_writes_);
+    const gpio_bits_t rising = value & ~level_;
+    if (rising & clock_) Increment(&clock_edges_);
+    if (rising & strobe_) Increment(&strobes_);
+    level_ |= value;
+  }
+
+  inline void Clear(gpio_bits_t value) {
+    Increment(&clear_writes_);
+    level_ &= ~value;
+  }
+
+  // Account for an output enable pulse of the given length.
+  void RecordPulse(long nanos);
+
+  // Current output level of all bits.
+  gpio_bits_t level() const { return level_; }
+
+  // A consistent-enough snapshot of the counters; can be called from any
+  // thread while the refresh thread is writing.
+  void GetCounters(Counters *counters) const;
+
+  // Register to write to where the real thing would need a dummy write.
+  volatile uint32_t *dummy_register() { return &dummy_register_; }
+
+private:
+  // Only the refresh thread writes, so no need for an atomic read-modify-write.
+  static inline void Increment(std::atomic<uint64_t> *counter) {
+    counter->store(counter->load(std::memory_order_relaxed) + 1,
+                   std::memory_order_relaxed);
+  }
+
+  gpio_bits_t level_;
+  gpio_bits_t clock_;
+  gpio_bits_t strobe_;
+  volatile uint32_t dummy_register_;
+
+  std::atomic<uint64_t> set_writes_;
+  std::atomic<uint64_t> clear_writes_;
+  std::atomic<uint64_t> clock_edges_;
+  std::atomic<uint64_t> strobes_;
+  std::atomic<uint64_t> oe_pulses_;
+  std::atomic<uint64_t> oe_nanoseconds_;
+};
+
 // For now, everything is initialized as output.
 class GPIO {
 public:
@@ -38,6 +106,14 @@ public:
   // (e.g. due to a permission problem).
   bool Init(int slowdown);
 
+  // Initialize with an in-memory register file instead of the hardware
+  // registers. Does not need root and works on any machine; meant for
+  // testing and benchmarking. Returns 'true' if successful.
+  bool InitEmulated();
+
+  // The emulated registers if initialized with InitEmulated(), NULL otherwise.
+  EmulatedGPIORegisters *emulation() const { return emulation_.get(); }
+
   // Initialize outputs.
   // Returns the bits that were available and could be set for output.
   // (never use the optional adafruit_hack_needed parameter, it is used
@@ -90,7 +166,12 @@ private:
     }
   }
 
+  // Only with EMULATED_GPIO_COUNT_WRITES the emulation sees every write;
+  // otherwise it writes to dummy registers like hardware, without a branch.
   inline gpio_bits_t ReadRegisters() const {
+#ifdef EMULATED_GPIO_COUNT_WRITES
+    if (emulation_) return emulation_->level();
+#endif
     return (static_cast<gpio_bits_t>(*gpio_read_bits_low_)
 #ifdef ENABLE_WIDE_GPIO_COMPUTE_MODULE
             | (static_cast<gpio_bits_t>(*gpio_read_bits_low_) << 32)
@@ -99,6 +180,12 @@ private:
   }
 
   inline void WriteSetBits(gpio_bits_t value) {
+#ifdef EMULATED_GPIO_COUNT_WRITES
+    if (emulation_) {
+      emulation_->Set(value);
+      return;
+    }
+#endif
     *gpio_set_bits_low_ = static_cast<uint32_t>(value & 0xFFFFFFFF);
 #ifdef ENABLE_WIDE_GPIO_COMPUTE_MODULE
     if (uses_64_bit_)
@@ -107,6 +194,12 @@ private:
   }
 
   inline void WriteClrBits(gpio_bits_t value) {
+#ifdef EMULATED_GPIO_COUNT_WRITES
+    if (emulation_) {
+      emulation_->Clear(value);
+      return;
+    }
+#endif
     *gpio_clr_bits_low_ = static_cast<uint32_t>(value & 0xFFFFFFFF);
 #ifdef ENABLE_WIDE_GPIO_COMPUTE_MODULE
     if (uses_64_bit_)
@@ -119,6 +212,7 @@ private:
   gpio_bits_t input_bits_;
   gpio_bits_t reserved_bits_;
   int slowdown_;
+  std::unique_ptr<EmulatedGPIORegisters> emulation_;
 
   volatile uint32_t *gpio_set_bits_low_;
   volatile uint32_t *gpio_clr_bits_low_;
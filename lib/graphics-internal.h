@@ -0,0 +1,102 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+// Copyright (C) 2014 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+#ifndef RPI_GRAPHICS_INTERNAL_H
+#define RPI_GRAPHICS_INTERNAL_H
+
+#include <stdlib.h>
+#include <algorithm>
+
+// The geometry of the drawing primitives, shared by the generic Canvas
+// versions in graphics.cc and the FrameCanvas ones writing to the bitplanes,
+// so both draw exactly the same pixels. "plot(x, y)" is called for each
+// pixel; it might be called more than once for the same pixel.
+namespace rgb_matrix {
+namespace internal {
+
+template <typename Plot>
+void TraceLine(int x0, int y0, int x1, int y1, Plot plot) {
+  int dy = y1 - y0, dx = x1 - x0, gradient, x, y, shift = 0x10;
+
+  if (abs(dx) > abs(dy)) {
+    // x variation is bigger than y variation
+    if (x1 < x0) {
+      std::swap(x0, x1);
+      std::swap(y0, y1);
+    }
+    gradient = (dy << shift) / dx ;
+
+    for (x = x0 , y = 0x8000 + (y0 << shift); x <= x1; ++x, y += gradient) {
+      plot(x, y >> shift);
+    }
+  } else if (dy != 0) {
+    // y variation is bigger than x variation
+    if (y1 < y0) {
+      std::swap(x0, x1);
+      std::swap(y0, y1);
+    }
+    gradient = (dx << shift) / dy;
+    for (y = y0 , x = 0x8000 + (x0 << shift); y <= y1; ++y, x += gradient) {
+      plot(x >> shift, y);
+    }
+  } else {
+    plot(x0, y0);
+  }
+}
+
+// A line "thickness" pixels wide: every pixel of the line above becomes a
+// "thickness" x "thickness" square extending to the right and down.
+template <typename Plot>
+void TraceThickLine(int x0, int y0, int x1, int y1, int thickness, Plot plot) {
+  if (thickness <= 1) {
+    TraceLine(x0, y0, x1, y1, plot);
+    return;
+  }
+  TraceLine(x0, y0, x1, y1, [&](int x, int y) {
+      for (int j = 0; j < thickness; ++j) {
+        for (int i = 0; i < thickness; ++i) {
+          plot(x + i, y + j);
+        }
+      }
+    });
+}
+
+template <typename Plot>
+void TraceCircle(int x0, int y0, int radius, Plot plot) {
+  int x = radius, y = 0;
+  int radiusError = 1 - x;
+
+  while (y <= x) {
+    plot(x + x0, y + y0);
+    plot(y + x0, x + y0);
+    plot(-x + x0, y + y0);
+    plot(-y + x0, x + y0);
+    plot(-x + x0, -y + y0);
+    plot(-y + x0, -x + y0);
+    plot(x + x0, -y + y0);
+    plot(y + x0, -x + y0);
+    y++;
+    if (radiusError<0){
+      radiusError += 2 * y + 1;
+    } else {
+      x--;
+      radiusError+= 2 * (y - x + 1);
+    }
+  }
+}
+
+}  // namespace internal
+}  // namespace rgb_matrix
+
+#endif  // RPI_GRAPHICS_INTERNAL_H
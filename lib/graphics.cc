@@ -14,8 +14,12 @@
 // along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
 
 #include "graphics.h"
+#include "led-matrix.h"
+#include "framebuffer-internal.h"
+#include "graphics-internal.h"
 #include "utf8-internal.h"
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <functional>
 #include <algorithm>
@@ -57,6 +61,15 @@ bool SetImage(Canvas *c, int canvas_offset_x, int canvas_offset_y,
   const size_t next_row_skip = skip_start_row + skip_end_row;
   buffer += skip_start_row;
 
+  // The FrameCanvas can take all rows in one go.
+  FrameCanvas *const frame = dynamic_cast<FrameCanvas*>(c);
+  if (frame != NULL) {
+    frame->SetPixelsFromBuffer(canvas_offset_x, canvas_offset_y,
+                               w - canvas_offset_x, h - canvas_offset_y,
+                               buffer, 3 * width, is_bgr);
+    return true;
+  }
+
   if (is_bgr) {
     for (int y = canvas_offset_y; y < h; ++y) {
       for (int x = canvas_offset_x; x < w; ++x) {
@@ -118,55 +131,173 @@ int VerticalDrawText(Canvas *c, const Font &font, int x, int y,
 }
 
 void DrawCircle(Canvas *c, int x0, int y0, int radius, const Color &color) {
-  int x = radius, y = 0;
-  int radiusError = 1 - x;
-
-  while (y <= x) {
-    c->SetPixel(x + x0, y + y0, color.r, color.g, color.b);
-    c->SetPixel(y + x0, x + y0, color.r, color.g, color.b);
-    c->SetPixel(-x + x0, y + y0, color.r, color.g, color.b);
-    c->SetPixel(-y + x0, x + y0, color.r, color.g, color.b);
-    c->SetPixel(-x + x0, -y + y0, color.r, color.g, color.b);
-    c->SetPixel(-y + x0, -x + y0, color.r, color.g, color.b);
-    c->SetPixel(x + x0, -y + y0, color.r, color.g, color.b);
-    c->SetPixel(y + x0, -x + y0, color.r, color.g, color.b);
-    y++;
-    if (radiusError<0){
-      radiusError += 2 * y + 1;
-    } else {
-      x--;
-      radiusError+= 2 * (y - x + 1);
-    }
+  FrameCanvas *const frame = dynamic_cast<FrameCanvas*>(c);
+  if (frame != NULL) {
+    frame->DrawCircle(x0, y0, radius, color);
+    return;
   }
+  internal::TraceCircle(x0, y0, radius, [&](int x, int y) {
+      c->SetPixel(x, y, color.r, color.g, color.b);
+    });
 }
 
 void DrawLine(Canvas *c, int x0, int y0, int x1, int y1, const Color &color) {
-  int dy = y1 - y0, dx = x1 - x0, gradient, x, y, shift = 0x10;
+  DrawLine(c, x0, y0, x1, y1, 1, color);
+}
 
-  if (abs(dx) > abs(dy)) {
-    // x variation is bigger than y variation
-    if (x1 < x0) {
-      std::swap(x0, x1);
-      std::swap(y0, y1);
-    }
-    gradient = (dy << shift) / dx ;
+void DrawLine(Canvas *c, int x0, int y0, int x1, int y1, int thickness,
+              const Color &color) {
+  FrameCanvas *const frame = dynamic_cast<FrameCanvas*>(c);
+  if (frame != NULL) {
+    frame->DrawLine(x0, y0, x1, y1, thickness, color);
+    return;
+  }
+  internal::TraceThickLine(x0, y0, x1, y1, thickness, [&](int x, int y) {
+      c->SetPixel(x, y, color.r, color.g, color.b);
+    });
+}
 
-    for (x = x0 , y = 0x8000 + (y0 << shift); x <= x1; ++x, y += gradient) {
-      c->SetPixel(x, y >> shift, color.r, color.g, color.b);
-    }
-  } else if (dy != 0) {
-    // y variation is bigger than x variation
-    if (y1 < y0) {
-      std::swap(x0, x1);
-      std::swap(y0, y1);
+void FillRectangle(Canvas *c, int x, int y, int width, int height,
+                   const Color &color) {
+  FrameCanvas *const frame = dynamic_cast<FrameCanvas*>(c);
+  if (frame != NULL) {
+    frame->FillRectangle(x, y, width, height, color);
+    return;
+  }
+  for (int row = y; row < y + height; ++row) {
+    for (int col = x; col < x + width; ++col) {
+      c->SetPixel(col, row, color.r, color.g, color.b);
     }
-    gradient = (dx << shift) / dy;
-    for (y = y0 , x = 0x8000 + (x0 << shift); y <= y1; ++y, x += gradient) {
-      c->SetPixel(x >> shift, y, color.r, color.g, color.b);
+  }
+}
+
+DrawList::DrawList() : has_fill_(false), last_color_(0) {}
+
+void DrawList::Clear() {
+  has_fill_ = false;
+  colors_.clear();
+  base_rects_.clear();
+  spans_.clear();
+}
+
+static bool SameColor(const Color &a, const Color &b) {
+  return a.r == b.r && a.g == b.g && a.b == b.b;
+}
+
+uint16_t DrawList::ColorIndex(const Color &color) {
+  // Typically the same color is used for a while, e.g. for a whole text.
+  if (last_color_ < colors_.size() && SameColor(colors_[last_color_], color))
+    return last_color_;
+  // Frames only use a handful of colors.
+  for (size_t i = 0; i < colors_.size(); ++i) {
+    if (SameColor(colors_[i], color)) return last_color_ = i;
+  }
+  colors_.push_back(color);
+  return last_color_ = colors_.size() - 1;
+}
+
+void DrawList::AddSpan(int x, int y, int length, uint16_t color,
+                       const uint8_t *pixels, bool is_bgr) {
+  if (x < 0) {
+    if (pixels) pixels += 3 * -x;
+    length += x;
+    x = 0;
+  }
+  if (y < 0 || y > INT16_MAX || x > INT16_MAX || length <= 0) return;
+  if (length > INT16_MAX - x) length = INT16_MAX - x;
+
+  // Continue the previous span if this just extends it, e.g. a horizontal
+  // line drawn pixel by pixel.
+  if (pixels == NULL && !spans_.empty()) {
+    Span &last = spans_.back();
+    if (last.pixels == NULL && last.y == y && last.color == color
+        && last.x + last.length == x && length <= INT16_MAX - last.length) {
+      last.length += length;
+      return;
     }
-  } else {
-    c->SetPixel(x0, y0, color.r, color.g, color.b);
   }
+
+  Span span;
+  span.x = x;
+  span.y = y;
+  span.length = length;
+  span.color = color;
+  span.pixels = pixels;
+  span.is_bgr = is_bgr;
+  spans_.push_back(span);
+}
+
+void DrawList::Fill(const Color &color) {
+  // Everything recorded so far is covered.
+  Clear();
+  has_fill_ = true;
+  fill_color_ = color;
+}
+
+void DrawList::FillRectangle(int x, int y, int width, int height,
+                             const Color &color) {
+  if (width <= 0 || height <= 0) return;
+  const uint16_t index = ColorIndex(color);
+  if (!has_fill_ && spans_.empty()) {
+    // Nothing underneath to skip, e.g. the erase box of a partial redraw.
+    const Rect rect = { x, y, width, height, index };
+    base_rects_.push_back(rect);
+    return;
+  }
+  for (int row = y; row < y + height; ++row) {
+    AddSpan(x, row, width, index, NULL, false);
+  }
+}
+
+void DrawList::DrawLine(int x0, int y0, int x1, int y1, const Color &color) {
+  DrawLine(x0, y0, x1, y1, 1, color);
+}
+
+void DrawList::DrawLine(int x0, int y0, int x1, int y1, int thickness,
+                        const Color &color) {
+  const uint16_t index = ColorIndex(color);
+  const int width = thickness > 1 ? thickness : 1;
+  internal::TraceLine(x0, y0, x1, y1, [&](int x, int y) {
+      for (int j = 0; j < width; ++j) {
+        AddSpan(x, y + j, width, index, NULL, false);
+      }
+    });
+}
+
+void DrawList::DrawCircle(int x0, int y0, int radius, const Color &color) {
+  const uint16_t index = ColorIndex(color);
+  internal::TraceCircle(x0, y0, radius, [&](int x, int y) {
+      AddSpan(x, y, 1, index, NULL, false);
+    });
+}
+
+bool DrawList::SetImage(int canvas_offset_x, int canvas_offset_y,
+                        const uint8_t *buffer, size_t size,
+                        int width, int height, bool is_bgr) {
+  if (3 * width * height != (int)size)   // Sanity check
+    return false;
+  for (int row = 0; row < height; ++row) {
+    AddSpan(canvas_offset_x, canvas_offset_y + row, width, 0,
+            buffer + 3 * width * row, is_bgr);
+  }
+  return true;
+}
+
+int DrawList::DrawText(const Font &font, int x, int y,
+                       const Color &color, const Color *background_color,
+                       const char *utf8_text, int extra_spacing) {
+  const int start_x = x;
+  while (*utf8_text) {
+    const uint32_t cp = utf8_next_codepoint(utf8_text);
+    x += font.DrawGlyph(this, x, y, color, background_color, cp);
+    x += extra_spacing;
+  }
+  return x - start_x;
+}
+
+void DrawList::Flush(FrameCanvas *c) {
+  c->framebuffer()->Draw(this);
+  Clear();
 }
 
 }//namespace
@@ -25,6 +25,8 @@
 // Make sure C++ is in sync with C
 static_assert(sizeof(rgb_matrix::RGBMatrix::Options) == sizeof(RGBLedMatrixOptions), "C and C++ out of sync");
 static_assert(sizeof(rgb_matrix::RuntimeOptions) == sizeof(RGBLedRuntimeOptions), "C and C++ out of sync");
+static_assert(sizeof(rgb_matrix::RGBMatrix::RefreshStats) == sizeof(RGBLedRefreshStats), "C and C++ out of sync");
+static_assert(rgb_matrix::RGBMatrix::RefreshStats::kHistogramBuckets == RGB_LED_REFRESH_STATS_BUCKETS, "C and C++ out of sync");
 
 // Our opaque dummy structs to communicate with the c-world
 struct RGBLedMatrix {};
@@ -89,6 +91,7 @@ static struct RGBLedMatrix *led_matrix_create_from_options_optional_edit(
     OPT_COPY_IF_SET(panel_type);
     OPT_COPY_IF_SET(limit_refresh_rate_hz);
     OPT_COPY_IF_SET(disable_busy_waiting);
+    OPT_COPY_IF_SET(triple_buffering);
 #undef OPT_COPY_IF_SET
   }
 
@@ -99,6 +102,7 @@ static struct RGBLedMatrix *led_matrix_create_from_options_optional_edit(
     RT_OPT_COPY_IF_SET(daemon);
     RT_OPT_COPY_IF_SET(drop_privileges);
     RT_OPT_COPY_IF_SET(do_gpio_init);
+    RT_OPT_COPY_IF_SET(emulate_gpio);
     RT_OPT_COPY_IF_SET(drop_priv_user);
     RT_OPT_COPY_IF_SET(drop_priv_group);
 #undef RT_OPT_COPY_IF_SET
@@ -136,6 +140,7 @@ static struct RGBLedMatrix *led_matrix_create_from_options_optional_edit(
     ACTUAL_VALUE_BACK_TO_OPT(panel_type);
     ACTUAL_VALUE_BACK_TO_OPT(limit_refresh_rate_hz);
     ACTUAL_VALUE_BACK_TO_OPT(disable_busy_waiting);
+    ACTUAL_VALUE_BACK_TO_OPT(triple_buffering);
 #undef ACTUAL_VALUE_BACK_TO_OPT
   }
 
@@ -145,6 +150,7 @@ static struct RGBLedMatrix *led_matrix_create_from_options_optional_edit(
     ACTUAL_VALUE_BACK_TO_RT_OPT(daemon);
     ACTUAL_VALUE_BACK_TO_RT_OPT(drop_privileges);
     ACTUAL_VALUE_BACK_TO_RT_OPT(do_gpio_init);
+    ACTUAL_VALUE_BACK_TO_RT_OPT(emulate_gpio);
     ACTUAL_VALUE_BACK_TO_RT_OPT(drop_priv_user);
     ACTUAL_VALUE_BACK_TO_RT_OPT(drop_priv_group);
 #undef ACTUAL_VALUE_BACK_TO_RT_OPT
@@ -207,6 +213,24 @@ struct LedCanvas *led_matrix_swap_on_vsync(struct RGBLedMatrix *matrix,
   return from_canvas(to_matrix(matrix)->SwapOnVSync(to_canvas(canvas)));
 }
 
+void led_matrix_get_refresh_stats(struct RGBLedMatrix *matrix,
+                                  struct RGBLedRefreshStats *stats) {
+  rgb_matrix::RGBMatrix::RefreshStats s;
+  to_matrix(matrix)->GetRefreshStats(&s);
+  stats->frames = s.frames;
+  stats->missed_deadlines = s.missed_deadlines;
+  memcpy(stats->frame_usec, s.frame_usec, sizeof(s.frame_usec));
+  memcpy(stats->dump_usec, s.dump_usec, sizeof(s.dump_usec));
+  memcpy(stats->oe_wait_usec, s.oe_wait_usec, sizeof(s.oe_wait_usec));
+  memcpy(stats->swap_latency_usec, s.swap_latency_usec,
+         sizeof(s.swap_latency_usec));
+}
+
+struct LedCanvas *led_matrix_publish_frame(struct RGBLedMatrix *matrix,
+                                           struct LedCanvas *canvas) {
+  return from_canvas(to_matrix(matrix)->PublishFrame(to_canvas(canvas)));
+}
+
 void led_matrix_set_brightness(struct RGBLedMatrix *matrix,
                                uint8_t brightness) {
   to_matrix(matrix)->SetBrightness(brightness);
@@ -16,7 +16,10 @@
 #include "led-matrix.h"
 
 #include <assert.h>
+#include <atomic>
 #include <grp.h>
+#include <limits.h>
+#include <linux/futex.h>
 #include <pwd.h>
 #include <math.h>
 #include <pthread.h>
@@ -24,6 +27,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <time.h>
@@ -44,6 +48,47 @@
 #endif
 
 namespace rgb_matrix {
+namespace {
+// Block while "word" still has the "expected" value, until woken up.
+// Spurious wakeups are possible, so callers check their condition in a loop.
+static void FutexWait(std::atomic<uint32_t> *word, uint32_t expected) {
+  static_assert(sizeof(*word) == sizeof(uint32_t), "futex needs 32 bit");
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT_PRIVATE,
+          expected, NULL, NULL, 0);
+}
+
+static void FutexWakeAll(std::atomic<uint32_t> *word) {
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE_PRIVATE,
+          INT_MAX, NULL, NULL, 0);
+}
+
+// Histogram of durations in power-of-two microsecond buckets. Written by a
+// single thread, can be read from any.
+class DurationHistogram {
+public:
+  static constexpr int kBuckets = RGBMatrix::RefreshStats::kHistogramBuckets;
+
+  DurationHistogram() {
+    for (int i = 0; i < kBuckets; ++i) count_[i].store(0);
+  }
+
+  inline void Add(uint32_t usec) {
+    int bucket = (usec == 0) ? 0 : 31 - __builtin_clz(usec);
+    if (bucket >= kBuckets) bucket = kBuckets - 1;
+    count_[bucket].store(count_[bucket].load(std::memory_order_relaxed) + 1,
+                         std::memory_order_relaxed);
+  }
+
+  void CopyTo(uint64_t *out) const {
+    for (int i = 0; i < kBuckets; ++i)
+      out[i] = count_[i].load(std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<uint64_t> count_[kBuckets];
+};
+}  // namespace
+
 // Implementation details of RGBmatrix.
 class RGBMatrix::Impl {
   class UpdateThread;
@@ -74,6 +119,7 @@ public:
 
   FrameCanvas *CreateFrameCanvas();
   FrameCanvas *SwapOnVSync(FrameCanvas *other, unsigned framerate_fraction);
+  FrameCanvas *PublishFrame(FrameCanvas *other);
   bool ApplyPixelMapper(const PixelMapper *mapper);
 
   bool SetPWMBits(uint8_t value);
@@ -87,6 +133,8 @@ public:
   void SetBrightness(uint8_t brightness);
   uint8_t brightness();
 
+  void SetColorCalibration(const ColorCalibration &calibration);
+
   uint64_t RequestInputs(uint64_t);
   uint64_t AwaitInputChange(int timeout_ms);
 
@@ -94,6 +142,9 @@ public:
   void OutputGPIO(uint64_t output_bits);
 
   void Clear();
+
+  bool GetEmulatedGPIOStats(EmulatedGPIOStats *stats) const;
+  void GetRefreshStats(RefreshStats *stats) const;
 private:
   friend class RGBMatrix;
 
@@ -102,8 +153,23 @@ private:
   void ApplyNamedPixelMappers(const char *pixel_mapper_config,
                               int chain, int parallel);
 
+  // Pixel mappers are collected with AddPixelMapper() and then applied
+  // together by ApplyPixelMappers(), building the new map only once.
+  struct MapperStage {
+    const PixelMapper *mapper;
+    int matrix_width, matrix_height;    // Size it maps to.
+    int visible_width, visible_height;  // Size after mapping.
+    bool is_transform;
+    PixelTransform transform;
+  };
+  // Returns false if "mapper" can't be applied to the current size.
+  bool AddPixelMapper(const PixelMapper *mapper);
+  void ApplyPixelMappers();
+  std::vector<MapperStage> mapper_stages_;
+
   Options params_;
   bool do_luminance_correct_;
+  ColorCalibration color_calibration_;
 
   FrameCanvas *active_;
 
@@ -120,15 +186,22 @@ using namespace internal;
 // Pump pixels to screen. Needs to be high priority real-time because jitter
 class RGBMatrix::Impl::UpdateThread : public Thread {
 public:
-  UpdateThread(GPIO *io, FrameCanvas *initial_frame,
+  // If "spare_frame" is given, frames are handed over lock-free through a
+  // triple buffer (see PublishFrame()); the spare is its initial third frame.
+  UpdateThread(GPIO *io, FrameCanvas *initial_frame, FrameCanvas *spare_frame,
                int pwm_dither_bits, bool show_refresh,
                int limit_refresh_hz, bool allow_busy_waiting)
     : io_(io), show_refresh_(show_refresh),
       target_frame_usec_(limit_refresh_hz < 1 ? 0 : 1e6/limit_refresh_hz),
       allow_busy_waiting_(allow_busy_waiting),
+      triple_buffering_(spare_frame != NULL),
       running_(true),
       current_frame_(initial_frame), next_frame_(NULL),
-      requested_frame_multiple_(1) {
+      requested_frame_multiple_(1),
+      published_frame_(reinterpret_cast<uintptr_t>(spare_frame)),
+      published_frame_multiple_(1), published_time_us_(0),
+      refresh_sequence_(0), refresh_waiters_(0),
+      swap_request_time_us_(0), frames_shown_(0), missed_deadlines_(0) {
     pthread_cond_init(&frame_done_, NULL);
     pthread_cond_init(&input_change_, NULL);
     switch (pwm_dither_bits) {
@@ -148,8 +221,7 @@ public:
   }
 
   void Stop() {
-    MutexLock l(&running_mutex_);
-    running_ = false;
+    running_.store(false);
   }
 
   virtual void Run() {
@@ -167,11 +239,43 @@ public:
     while (running()) {
       const uint32_t start_time_us = GetMicrosecondCounter();
 
+      // Timing the OE wait takes two clock reads per row and bitplane, so
+      // only do that on a sample of the frames.
+      const bool sample_oe_wait = (low_bit_sequence % kOEWaitSampling == 0);
+      uint32_t oe_wait_us = 0;
       current_frame_->framebuffer()
-        ->DumpToMatrix(io_, start_bit_[low_bit_sequence % 4]);
-
-      // SwapOnVSync() exchange.
-      {
+        ->DumpToMatrix(io_, start_bit_[low_bit_sequence % 4],
+                       sample_oe_wait ? &oe_wait_us : NULL);
+      dump_histogram_.Add(GetMicrosecondCounter() - start_time_us);
+      if (sample_oe_wait) oe_wait_histogram_.Add(oe_wait_us);
+
+      frames_shown_.store(frames_shown_.load(std::memory_order_relaxed) + 1,
+                          std::memory_order_release);
+
+      if (triple_buffering_) {
+        // PublishFrame() exchange. Never waits for the producer.
+        const unsigned multiple
+          = published_frame_multiple_.load(std::memory_order_relaxed);
+        if (frame_count == multiple || frame_count % multiple == 0) {
+          frame_count = 0;
+          if (published_frame_.load(std::memory_order_acquire) & kFreshFrame) {
+            // Take the latest published frame, leave ours to be reused.
+            const uintptr_t published = published_frame_.exchange(
+              reinterpret_cast<uintptr_t>(current_frame_),
+              std::memory_order_acq_rel);
+            current_frame_
+              = reinterpret_cast<FrameCanvas*>(published & ~kFreshFrame);
+            swap_latency_histogram_.Add(
+              GetMicrosecondCounter()
+              - published_time_us_.load(std::memory_order_relaxed));
+          }
+        }
+        // Wake up blocking PublishFrame() and WaitForVSync(). Only a
+        // syscall if someone is actually waiting.
+        refresh_sequence_.fetch_add(1);
+        if (refresh_waiters_.load() > 0) FutexWakeAll(&refresh_sequence_);
+      } else {
+        // SwapOnVSync() exchange.
         MutexLock l(&frame_sync_);
         // Do fast equality test first (likely due to frame_count reset).
         if (frame_count == requested_frame_multiple_
@@ -182,6 +286,8 @@ public:
           if (next_frame_ != NULL) {
             current_frame_ = next_frame_;
             next_frame_ = NULL;
+            swap_latency_histogram_.Add(GetMicrosecondCounter()
+                                        - swap_request_time_us_);
           }
           pthread_cond_signal(&frame_done_);
         }
@@ -200,6 +306,11 @@ public:
       ++low_bit_sequence;
 
       if (target_frame_usec_) {
+        if (GetMicrosecondCounter() - start_time_us > target_frame_usec_) {
+          missed_deadlines_.store(
+            missed_deadlines_.load(std::memory_order_relaxed) + 1,
+            std::memory_order_relaxed);
+        }
         if (allow_busy_waiting_) {
           while ((GetMicrosecondCounter() - start_time_us) < target_frame_usec_) {
             // busy wait. We have our dedicated core, so ok to burn cycles.
@@ -211,6 +322,7 @@ public:
       }
 
       const uint32_t end_time_us = GetMicrosecondCounter();
+      frame_histogram_.Add(end_time_us - start_time_us);
       if (show_refresh_) {
         uint32_t usec = end_time_us - start_time_us;
         printf("\b\b\b\b\b\b\b\b%6.1fHz", 1e6 / usec);
@@ -227,10 +339,51 @@ public:
     }
   }
 
+  // Triple buffering: hand over "frame" to be picked up at the next VSync.
+  // Returns a frame that is neither shown nor pending. With "wait_for_vsync",
+  // only returns once the refresh thread has picked up the frame.
+  FrameCanvas *PublishFrame(FrameCanvas *frame, unsigned frame_fraction,
+                            bool wait_for_vsync) {
+    assert(triple_buffering_);
+    published_frame_multiple_.store(frame_fraction, std::memory_order_relaxed);
+    published_time_us_.store(GetMicrosecondCounter(),
+                             std::memory_order_relaxed);
+    const uintptr_t previous = published_frame_.exchange(
+      reinterpret_cast<uintptr_t>(frame) | kFreshFrame,
+      std::memory_order_acq_rel);
+    if (wait_for_vsync) {
+      AwaitRefresh([this]() {
+          return (published_frame_.load(std::memory_order_acquire)
+                  & kFreshFrame) == 0;
+        });
+    }
+    return reinterpret_cast<FrameCanvas*>(previous & ~kFreshFrame);
+  }
+
+  // Wait until the next frame has been shown.
+  void WaitForVSync() {
+    const uint64_t start = frames_shown();
+    AwaitRefresh([this, start]() { return frames_shown() != start; });
+  }
+
+  uint64_t frames_shown() const {
+    return frames_shown_.load(std::memory_order_acquire);
+  }
+
+  void GetRefreshStats(RefreshStats *stats) const {
+    stats->frames = frames_shown();
+    stats->missed_deadlines = missed_deadlines_.load(std::memory_order_relaxed);
+    frame_histogram_.CopyTo(stats->frame_usec);
+    dump_histogram_.CopyTo(stats->dump_usec);
+    oe_wait_histogram_.CopyTo(stats->oe_wait_usec);
+    swap_latency_histogram_.CopyTo(stats->swap_latency_usec);
+  }
+
   FrameCanvas *SwapOnVSync(FrameCanvas *other, unsigned frame_fraction) {
     MutexLock l(&frame_sync_);
     FrameCanvas *previous = current_frame_;
     next_frame_ = other;
+    swap_request_time_us_ = GetMicrosecondCounter();
     requested_frame_multiple_ = frame_fraction;
     frame_sync_.WaitOn(&frame_done_);
     return previous;
@@ -243,19 +396,37 @@ public:
   }
 
 private:
+  // Low bit in published_frame_: frame is published, but not yet picked up.
+  static constexpr uintptr_t kFreshFrame = 1;
+  // Every n-th frame gets its OE wait timed. Not a multiple of the four
+  // dither steps, so that all of them are sampled.
+  static constexpr unsigned kOEWaitSampling = 17;
+
   inline bool running() {
-    MutexLock l(&running_mutex_);
-    return running_;
+    return running_.load(std::memory_order_relaxed);
+  }
+
+  // Triple buffering: block until "done" returns true, re-checking it after
+  // each frame. Registering as waiter before reading the sequence makes sure
+  // that the refresh thread either sees us waiting or we see its increment.
+  template <typename Condition> void AwaitRefresh(Condition done) {
+    refresh_waiters_.fetch_add(1);
+    for (;;) {
+      const uint32_t sequence = refresh_sequence_.load();
+      if (done()) break;
+      FutexWait(&refresh_sequence_, sequence);
+    }
+    refresh_waiters_.fetch_sub(1);
   }
 
   GPIO *const io_;
   const bool show_refresh_;
   const uint32_t target_frame_usec_;
   const bool allow_busy_waiting_;
+  const bool triple_buffering_;
   uint32_t start_bit_[4];
 
-  Mutex running_mutex_;
-  bool running_;
+  std::atomic<bool> running_;
 
   Mutex input_sync_;
   pthread_cond_t input_change_;
@@ -266,6 +437,22 @@ private:
   FrameCanvas *current_frame_;
   FrameCanvas *next_frame_;
   unsigned requested_frame_multiple_;
+
+  // Triple buffering: the frame in the middle, between producer and refresh.
+  std::atomic<uintptr_t> published_frame_;
+  std::atomic<unsigned> published_frame_multiple_;
+  std::atomic<uint32_t> published_time_us_;
+  std::atomic<uint32_t> refresh_sequence_;  // Futex, counts frames shown.
+  std::atomic<int> refresh_waiters_;
+
+  // Timing, see GetRefreshStats().
+  uint32_t swap_request_time_us_;  // Guarded by frame_sync_
+  std::atomic<uint64_t> frames_shown_;
+  std::atomic<uint64_t> missed_deadlines_;
+  DurationHistogram frame_histogram_;
+  DurationHistogram dump_histogram_;
+  DurationHistogram oe_wait_histogram_;
+  DurationHistogram swap_latency_histogram_;
 };
 
 // Some defaults. See options-initialize.cc for the command line parsing.
@@ -330,6 +517,7 @@ RGBMatrix::Options::Options() :
 #else
     disable_busy_waiting(false)
 #endif
+  , triple_buffering(false)
 {
   // Nothing to see here.
 }
@@ -361,6 +549,7 @@ static void PrintOptions(const RGBMatrix::Options &o) {
   P_STR(panel_type);
   P_INT(limit_refresh_rate_hz);
   P_BOOL(disable_busy_waiting);
+  P_BOOL(triple_buffering);
 #undef P_INT
 #undef P_STR
 #undef P_BOOL
@@ -396,7 +585,7 @@ RGBMatrix::Impl::Impl(GPIO *io, const Options &options)
   SetGPIO(io, true);
 
   // We need to apply the mapping for the panels first.
-  ApplyPixelMapper(multiplex_mapper);
+  AddPixelMapper(multiplex_mapper);
 
   // .. followed by higher level mappers that might arrange panels.
   ApplyNamedPixelMappers(options.pixel_mapper_config,
@@ -440,8 +629,13 @@ void RGBMatrix::Impl::OutputGPIO(uint64_t output_bits) {
 
 void RGBMatrix::Impl::ApplyNamedPixelMappers(const char *pixel_mapper_config,
                                              int chain, int parallel) {
-  if (pixel_mapper_config == NULL || strlen(pixel_mapper_config) == 0)
+  // Registered mappers are shared, so one that needs to map each pixel has
+  // to be applied before it possibly gets new parameters.
+  bool needs_apply = false;
+  if (pixel_mapper_config == NULL || strlen(pixel_mapper_config) == 0) {
+    ApplyPixelMappers();
     return;
+  }
   char *const writeable_copy = strdup(pixel_mapper_config);
   const char *const end = writeable_copy + strlen(writeable_copy);
   char *s = writeable_copy;
@@ -456,11 +650,16 @@ void RGBMatrix::Impl::ApplyNamedPixelMappers(const char *pixel_mapper_config,
       fprintf(stderr, "Stray parameter ':%s' without mapper name ?\n", optional_param_start);
     }
     if (*s) {
-      ApplyPixelMapper(FindPixelMapper(s, chain, parallel, optional_param_start));
+      if (needs_apply) ApplyPixelMappers();
+      const PixelMapper *mapper = FindPixelMapper(s, chain, parallel,
+                                                  optional_param_start);
+      needs_apply = (AddPixelMapper(mapper) && mapper != NULL
+                     && !mapper_stages_.back().is_transform);
     }
     s = semicolon + 1;
   }
   free(writeable_copy);
+  ApplyPixelMappers();
 }
 
 void RGBMatrix::Impl::SetGPIO(GPIO *io, bool start_thread) {
@@ -480,7 +679,9 @@ void RGBMatrix::Impl::SetGPIO(GPIO *io, bool start_thread) {
 
 bool RGBMatrix::Impl::StartRefresh() {
   if (updater_ == NULL && io_ != NULL) {
-    updater_ = new UpdateThread(io_, active_, params_.pwm_dither_bits,
+    FrameCanvas *const spare = params_.triple_buffering
+      ? CreateFrameCanvas() : NULL;
+    updater_ = new UpdateThread(io_, active_, spare, params_.pwm_dither_bits,
                                 params_.show_refresh_rate,
                                 params_.limit_refresh_rate_hz,
                                 !params_.disable_busy_waiting);
@@ -491,7 +692,9 @@ bool RGBMatrix::Impl::StartRefresh() {
     //   core #3 will succeed.
     // The Raspberry Pi1 only has one core, so this affinity
     //   call will simply fail and we keep using the only core.
-    updater_->Start(99, (1<<3));  // Prio: high. Also: put on last CPU.
+    // No need for realtime priority if we're not driving real hardware.
+    updater_->Start(io_->emulation() ? 0 : 99,
+                    (1<<3));  // Prio: high. Also: put on last CPU.
   }
   return updater_ != NULL;
 }
@@ -513,6 +716,7 @@ FrameCanvas *RGBMatrix::Impl::CreateFrameCanvas() {
   result->framebuffer()->SetPWMBits(params_.pwm_bits);
   result->framebuffer()->set_luminance_correct(do_luminance_correct_);
   result->framebuffer()->SetBrightness(params_.brightness);
+  result->framebuffer()->SetColorCalibration(color_calibration_);
 
   created_frames_.push_back(result);
 
@@ -536,16 +740,57 @@ FrameCanvas *RGBMatrix::Impl::SwapOnVSync(FrameCanvas *other,
                                           unsigned frame_fraction) {
   if (frame_fraction == 0) frame_fraction = 1; // correct user error.
   if (!updater_) return NULL;
+  if (params_.triple_buffering) {
+    if (other == NULL) {
+      updater_->WaitForVSync();
+      return active_;
+    }
+    FrameCanvas *const free_frame
+      = updater_->PublishFrame(other, frame_fraction, true);
+    active_ = other;
+    return free_frame;
+  }
   FrameCanvas *const previous = updater_->SwapOnVSync(other, frame_fraction);
   if (other) active_ = other;
   return previous;
 }
 
+FrameCanvas *RGBMatrix::Impl::PublishFrame(FrameCanvas *other) {
+  if (!params_.triple_buffering || other == NULL)
+    return SwapOnVSync(other, 1);
+  if (!updater_) return NULL;
+  FrameCanvas *const free_frame = updater_->PublishFrame(other, 1, false);
+  active_ = other;
+  return free_frame;
+}
+
 uint64_t RGBMatrix::Impl::AwaitInputChange(int timeout_ms) {
   if (!updater_) return 0;
   return updater_->AwaitInputChange(timeout_ms);
 }
 
+void RGBMatrix::Impl::GetRefreshStats(RefreshStats *stats) const {
+  if (updater_ == NULL) {
+    memset(stats, 0, sizeof(*stats));
+    return;
+  }
+  updater_->GetRefreshStats(stats);
+}
+
+bool RGBMatrix::Impl::GetEmulatedGPIOStats(EmulatedGPIOStats *stats) const {
+  if (io_ == NULL || io_->emulation() == NULL) return false;
+  EmulatedGPIORegisters::Counters counters;
+  io_->emulation()->GetCounters(&counters);
+  stats->frames = updater_ ? updater_->frames_shown() : 0;
+  stats->set_writes = counters.set_writes;
+  stats->clear_writes = counters.clear_writes;
+  stats->clock_edges = counters.clock_edges;
+  stats->strobes = counters.strobes;
+  stats->oe_pulses = counters.oe_pulses;
+  stats->oe_nanoseconds = counters.oe_nanoseconds;
+  return true;
+}
+
 bool RGBMatrix::Impl::SetPWMBits(uint8_t value) {
   const bool success = active_->framebuffer()->SetPWMBits(value);
   if (success) {
@@ -575,36 +820,185 @@ uint8_t RGBMatrix::Impl::brightness() {
   return params_.brightness;
 }
 
+void RGBMatrix::Impl::SetColorCalibration(const ColorCalibration &calibration) {
+  for (size_t i = 0; i < created_frames_.size(); ++i) {
+    created_frames_[i]->framebuffer()->SetColorCalibration(calibration);
+  }
+  color_calibration_ = calibration;
+}
+
 bool RGBMatrix::Impl::ApplyPixelMapper(const PixelMapper *mapper) {
+  if (!AddPixelMapper(mapper)) return false;
+  ApplyPixelMappers();
+  return true;
+}
+
+bool RGBMatrix::Impl::AddPixelMapper(const PixelMapper *mapper) {
   if (mapper == NULL) return true;
+  MapperStage stage;
+  stage.mapper = mapper;
+  if (mapper_stages_.empty()) {
+    stage.matrix_width = shared_pixel_mapper_->width();
+    stage.matrix_height = shared_pixel_mapper_->height();
+  } else {
+    stage.matrix_width = mapper_stages_.back().visible_width;
+    stage.matrix_height = mapper_stages_.back().visible_height;
+  }
+  if (!mapper->GetSizeMapping(stage.matrix_width, stage.matrix_height,
+                              &stage.visible_width, &stage.visible_height)) {
+    return false;
+  }
+  // Rotations and mirroring don't need to be asked for each pixel.
+  stage.is_transform = mapper->GetTransform(stage.matrix_width,
+                                            stage.matrix_height,
+                                            &stage.transform);
+  mapper_stages_.push_back(stage);
+  return true;
+}
+
+// The transform doing "inner" first, then "outer".
+static PixelTransform ComposeTransforms(const PixelTransform &outer,
+                                        const PixelTransform &inner) {
+  const PixelTransform result = {
+    outer.xx * inner.xx + outer.xy * inner.yx,
+    outer.xx * inner.xy + outer.xy * inner.yy,
+    outer.xx * inner.x0 + outer.xy * inner.y0 + outer.x0,
+    outer.yx * inner.xx + outer.yy * inner.yx,
+    outer.yx * inner.xy + outer.yy * inner.yy,
+    outer.yx * inner.x0 + outer.yy * inner.y0 + outer.y0,
+  };
+  return result;
+}
+
+// Whether "t" maps each pixel of a width x height canvas to a different
+// pixel of the matrix, using all of it. With a determinant of +/-1 no two
+// pixels end up on the same one; the image of the canvas is convex, so it is
+// within the matrix if its corners are.
+static bool MapsOneToOne(const PixelTransform &t, int width, int height,
+                         int matrix_width, int matrix_height) {
+  const int det = t.xx * t.yy - t.xy * t.yx;
+  if ((det != 1 && det != -1) || width * height != matrix_width * matrix_height)
+    return false;
+  const int corners[4][2] = { { 0, 0 }, { width - 1, 0 },
+                              { 0, height - 1 }, { width - 1, height - 1 } };
+  for (const auto &c : corners) {
+    const int x = t.xx * c[0] + t.xy * c[1] + t.x0;
+    const int y = t.yx * c[0] + t.yy * c[1] + t.y0;
+    if (x < 0 || y < 0 || x >= matrix_width || y >= matrix_height)
+      return false;
+  }
+  return true;
+}
+
+void RGBMatrix::Impl::ApplyPixelMappers() {
   using internal::PixelDesignatorMap;
+  if (mapper_stages_.empty()) return;
+  std::vector<MapperStage> stages;
+  stages.swap(mapper_stages_);
   const int old_width = shared_pixel_mapper_->width();
   const int old_height = shared_pixel_mapper_->height();
-  int new_width, new_height;
-  if (!mapper->GetSizeMapping(old_width, old_height, &new_width, &new_height)) {
-    return false;
+  const int width = stages.back().visible_width;
+  const int height = stages.back().visible_height;
+
+  // If all are transforms, they compose with the one of the current map.
+  const PixelTransform *old_transform = shared_pixel_mapper_->transform();
+  bool is_transform = (old_transform != NULL);
+  PixelTransform transform = is_transform ? *old_transform : PixelTransform();
+  bool stages_are_transforms = true;
+  PixelTransform stages_transform = { 1, 0, 0, 0, 1, 0 };
+  for (const MapperStage &stage : stages) {
+    if (!stage.is_transform) is_transform = stages_are_transforms = false;
+    if (is_transform) {
+      transform = ComposeTransforms(transform, stage.transform);
+    }
+    if (stages_are_transforms) {
+      stages_transform = ComposeTransforms(stages_transform, stage.transform);
+    }
   }
+
   PixelDesignatorMap *new_mapper = new PixelDesignatorMap(
-    new_width, new_height, shared_pixel_mapper_->GetFillColorBits());
-  for (int y = 0; y < new_height; ++y) {
-    for (int x = 0; x < new_width; ++x) {
-      int orig_x = -1, orig_y = -1;
-      mapper->MapVisibleToMatrix(old_width, old_height,
-                                 x, y, &orig_x, &orig_y);
-      if (orig_x < 0 || orig_y < 0 ||
-          orig_x >= old_width || orig_y >= old_height) {
-        fprintf(stderr, "Error in PixelMapper: (%d, %d) -> (%d, %d) [range: "
-                "%dx%d]\n", x, y, orig_x, orig_y, old_width, old_height);
-        continue;
+    width, height, *shared_pixel_mapper_);
+
+  // Only rotations and mirroring: one transform, known to be one-to-one
+  // without looking at each pixel.
+  if (stages_are_transforms && MapsOneToOne(stages_transform, width, height,
+                                            old_width, old_height)) {
+    const PixelTransform &t = stages_transform;
+    for (int y = 0; y < height; ++y) {
+      for (int x = 0; x < width; ++x) {
+        *new_mapper->get(x, y) = *shared_pixel_mapper_->get(
+          t.xx * x + t.xy * y + t.x0, t.yx * x + t.yy * y + t.y0);
+      }
+    }
+    if (is_transform) {
+      new_mapper->SetTransform(&transform);
+    }
+    delete shared_pixel_mapper_;
+    shared_pixel_mapper_ = new_mapper;
+    return;
+  }
+
+  // Map each visible pixel through all the stages, and check that the
+  // result is one-to-one.
+  std::vector<uint8_t> used(old_width * old_height, 0);
+  int unmapped = 0, duplicates = 0;
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      int matrix_x = x, matrix_y = y;
+      bool mapped = true;
+      for (size_t i = stages.size(); mapped && i > 0; --i) {
+        const MapperStage &stage = stages[i - 1];
+        const int visible_x = matrix_x, visible_y = matrix_y;
+        if (stage.is_transform) {
+          const PixelTransform &t = stage.transform;
+          matrix_x = t.xx * visible_x + t.xy * visible_y + t.x0;
+          matrix_y = t.yx * visible_x + t.yy * visible_y + t.y0;
+        } else {
+          matrix_x = matrix_y = -1;
+          stage.mapper->MapVisibleToMatrix(stage.matrix_width,
+                                           stage.matrix_height,
+                                           visible_x, visible_y,
+                                           &matrix_x, &matrix_y);
+        }
+        if (matrix_x < 0 || matrix_y < 0 ||
+            matrix_x >= stage.matrix_width ||
+            matrix_y >= stage.matrix_height) {
+          if (unmapped == 0) {
+            fprintf(stderr, "Error in PixelMapper %s: (%d, %d) -> (%d, %d) "
+                    "[range: %dx%d]\n", stage.mapper->GetName(),
+                    visible_x, visible_y, matrix_x, matrix_y,
+                    stage.matrix_width, stage.matrix_height);
+          }
+          ++unmapped;
+          mapped = false;
+        }
+      }
+      if (!mapped) continue;
+      uint8_t &use = used[matrix_y * old_width + matrix_x];
+      if (use) ++duplicates;
+      use = 1;
+      *new_mapper->get(x, y) = *shared_pixel_mapper_->get(matrix_x, matrix_y);
+    }
+  }
+  int unused = 0;
+  for (int y = 0; y < old_height; ++y) {
+    for (int x = 0; x < old_width; ++x) {
+      if (!used[y * old_width + x]
+          && !shared_pixel_mapper_->get(x, y)->unused()) {
+        ++unused;
       }
-      const internal::PixelDesignator *orig_designator;
-      orig_designator = shared_pixel_mapper_->get(orig_x, orig_y);
-      *new_mapper->get(x, y) = *orig_designator;
     }
   }
+  if (unmapped || duplicates || unused) {
+    fprintf(stderr, "PixelMapper: %d visible pixels not mapped, %d mapped "
+            "to an already used pixel, %d of %dx%d pixels not shown.\n",
+            unmapped, duplicates, unused, old_width, old_height);
+  }
+  if (is_transform && unmapped == 0) {
+    new_mapper->SetTransform(&transform);
+  }
   delete shared_pixel_mapper_;
   shared_pixel_mapper_ = new_mapper;
-  return true;
 }
 
 // -- Public interface of RGBMatrix. Delegate everything to impl_
@@ -667,8 +1061,10 @@ RGBMatrix *RGBMatrix::CreateFromOptions(const RGBMatrix::Options &options,
   }
 
   static GPIO io;  // This static var is a little bit icky.
-  if (runtime_options.do_gpio_init
-      && !io.Init(runtime_options.gpio_slowdown)) {
+  if (runtime_options.do_gpio_init && runtime_options.emulate_gpio) {
+    io.InitEmulated();
+  } else if (runtime_options.do_gpio_init
+             && !io.Init(runtime_options.gpio_slowdown)) {
     fprintf(stderr, "Must run as root to be able to access /dev/mem\n"
             "Prepend 'sudo' to the command\n");
     return NULL;
@@ -719,6 +1115,9 @@ FrameCanvas *RGBMatrix::SwapOnVSync(FrameCanvas *other,
                                     unsigned framerate_fraction) {
   return impl_->SwapOnVSync(other, framerate_fraction);
 }
+FrameCanvas *RGBMatrix::PublishFrame(FrameCanvas *other) {
+  return impl_->PublishFrame(other);
+}
 bool RGBMatrix::ApplyPixelMapper(const PixelMapper *mapper) {
   return impl_->ApplyPixelMapper(mapper);
 }
@@ -734,6 +1133,9 @@ void RGBMatrix::SetBrightness(uint8_t brightness) {
   impl_->SetBrightness(brightness);
 }
 uint8_t RGBMatrix::brightness() { return impl_->brightness(); }
+void RGBMatrix::SetColorCalibration(const ColorCalibration &calibration) {
+  impl_->SetColorCalibration(calibration);
+}
 
 uint64_t RGBMatrix::RequestInputs(uint64_t all_interested_bits) {
   return impl_->RequestInputs(all_interested_bits);
@@ -751,6 +1153,14 @@ void RGBMatrix::OutputGPIO(uint64_t output_bits) {
 
 bool RGBMatrix::StartRefresh() { return impl_->StartRefresh(); }
 
+bool RGBMatrix::GetEmulatedGPIOStats(EmulatedGPIOStats *stats) const {
+  return impl_->GetEmulatedGPIOStats(stats);
+}
+
+void RGBMatrix::GetRefreshStats(RefreshStats *stats) const {
+  impl_->GetRefreshStats(stats);
+}
+
 // -- Implementation of RGBMatrix Canvas: delegation to ContentBuffer
 int RGBMatrix::width() const {
   return impl_->active_->width();
@@ -784,6 +1194,22 @@ void FrameCanvas::SetPixels(int x, int y, int width, int height,
                          Color *colors) {
   frame_->SetPixels(x, y, width, height, colors);
 }
+void FrameCanvas::SetPixelsFromBuffer(int x, int y, int width, int height,
+                                      const uint8_t *buffer, size_t stride,
+                                      bool is_bgr) {
+  frame_->SetPixelsFromBuffer(x, y, width, height, buffer, stride, is_bgr);
+}
+void FrameCanvas::DrawLine(int x0, int y0, int x1, int y1, int thickness,
+                           const Color &color) {
+  frame_->DrawLine(x0, y0, x1, y1, thickness, color.r, color.g, color.b);
+}
+void FrameCanvas::DrawCircle(int x, int y, int radius, const Color &color) {
+  frame_->DrawCircle(x, y, radius, color.r, color.g, color.b);
+}
+void FrameCanvas::FillRectangle(int x, int y, int width, int height,
+                                const Color &color) {
+  frame_->FillRectangle(x, y, width, height, color.r, color.g, color.b);
+}
 void FrameCanvas::Clear() { return frame_->Clear(); }
 void FrameCanvas::Fill(uint8_t red, uint8_t green, uint8_t blue) {
   frame_->Fill(red, green, blue);
@@ -797,6 +1223,12 @@ bool FrameCanvas::luminance_correct() const { return frame_->luminance_correct()
 
 void FrameCanvas::SetBrightness(uint8_t brightness) { frame_->SetBrightness(brightness); }
 uint8_t FrameCanvas::brightness() { return frame_->brightness(); }
+void FrameCanvas::SetColorCalibration(const ColorCalibration &calibration) {
+  frame_->SetColorCalibration(calibration);
+}
+const ColorCalibration &FrameCanvas::color_calibration() const {
+  return frame_->color_calibration();
+}
 
 void FrameCanvas::Serialize(const char **data, size_t *len) const {
   frame_->Serialize(data, len);
@@ -807,4 +1239,19 @@ bool FrameCanvas::Deserialize(const char *data, size_t len) {
 void FrameCanvas::CopyFrom(const FrameCanvas &other) {
   frame_->CopyFrom(other.frame_);
 }
+uint64_t FrameCanvas::DirtyRows() const { return frame_->dirty_rows(); }
+void FrameCanvas::ClearDirtyRows() { frame_->ClearDirtyRows(); }
+void FrameCanvas::CopyRowsFrom(const FrameCanvas &other, uint64_t rows) {
+  frame_->CopyRowsFrom(other.frame_, rows);
+}
+uint64_t FrameCanvas::DiffRows(const FrameCanvas &other) const {
+  return frame_->DiffRows(other.frame_);
+}
+void FrameCanvas::SerializeRow(int double_row,
+                               const char **data, size_t *len) const {
+  frame_->SerializeRow(double_row, data, len);
+}
+bool FrameCanvas::XorSerialized(size_t offset, const char *data, size_t len) {
+  return frame_->XorSerialized(offset, data, len);
+}
 }  // end namespace rgb_matrix
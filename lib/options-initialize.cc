@@ -41,7 +41,8 @@ RuntimeOptions::RuntimeOptions() :
   drop_privileges(1),   // Encourage good practice: drop privileges by default.
   do_gpio_init(true),
   drop_priv_user("daemon"),
-  drop_priv_group("daemon")
+  drop_priv_group("daemon"),
+  emulate_gpio(false)
 {
   // Nothing to see here.
 }
@@ -215,6 +216,9 @@ static bool FlagInit(int &argc, char **&argv,
         continue;
       }
 
+      if (ConsumeBoolFlag("triple-buffer", it, &mopts->triple_buffering))
+        continue;
+
       bool request_help = false;
       if (ConsumeBoolFlag("help", it, &request_help) && request_help) {
         // In that case, we pretend to have failure in parsing, which will
@@ -225,6 +229,8 @@ static bool FlagInit(int &argc, char **&argv,
       //-- Runtime options.
       if (ConsumeIntFlag("slowdown-gpio", it, end, &ropts->gpio_slowdown, &err))
         continue;
+      if (ConsumeBoolFlag("emulate-gpio", it, &ropts->emulate_gpio))
+        continue;
       if (ropts->daemon >= 0 && ConsumeBoolFlag("daemon", it, &bool_scratch)) {
         ropts->daemon = bool_scratch ? 1 : 0;
         continue;
@@ -345,7 +351,8 @@ void PrintMatrixFlags(FILE *out, const RGBMatrix::Options &d,
           "(Default: 0)\n"
           "\t--led-%shardware-pulse   : %sse hardware pin-pulse generation.\n"
           "\t--led-panel-type=<name>   : Needed to initialize special panels. Supported: 'FM6126A', 'FM6127'\n"
-          "\t--led-%sbusy-waiting     : %sse busy waiting when limiting refresh rate.\n",
+          "\t--led-%sbusy-waiting     : %sse busy waiting when limiting refresh rate.\n"
+          "\t--led-%striple-buffer    : %sse lock-free triple buffering to hand over frames.\n",
           d.hardware_mapping,
           d.rows, d.cols, d.chain_length, d.parallel,
           (int) muxers.size(), CreateAvailableMultiplexString(muxers).c_str(),
@@ -359,7 +366,9 @@ void PrintMatrixFlags(FILE *out, const RGBMatrix::Options &d,
           !d.disable_hardware_pulsing ? "no-" : "",
           !d.disable_hardware_pulsing ? "Don't u" : "U",
           !d.disable_busy_waiting ? "no-" : "",
-          !d.disable_busy_waiting ? "Don't u" : "U");
+          !d.disable_busy_waiting ? "Don't u" : "U",
+          d.triple_buffering ? "no-" : "",
+          d.triple_buffering ? "Don't u" : "U");
 
   fprintf(out,
           "\t--led-slowdown-gpio=<%d..4>: "
@@ -368,6 +377,10 @@ void PrintMatrixFlags(FILE *out, const RGBMatrix::Options &d,
           (LED_MATRIX_ALLOW_BARRIER_DELAY ? -1 : 0), r.gpio_slowdown,
           LED_MATRIX_ALLOW_BARRIER_DELAY ? "Use -1 for memory barrier approach"
                                          : "");
+  fprintf(out,
+          "\t--led-%semulate-gpio       : %sse in-memory GPIO emulation "
+          "instead of hardware (for testing).\n",
+          r.emulate_gpio ? "no-" : "", r.emulate_gpio ? "Don't u" : "U");
   if (r.daemon >= 0) {
     const bool on = (r.daemon > 0);
     fprintf(out,
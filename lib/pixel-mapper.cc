@@ -86,6 +86,25 @@ public:
     }
   }
 
+  virtual bool GetTransform(int matrix_width, int matrix_height,
+                            PixelTransform *t) const {
+    switch (angle_) {
+    case 0:
+      *t = { 1, 0, 0, 0, 1, 0 };
+      break;
+    case 90:
+      *t = { 0, -1, matrix_width - 1, 1, 0, 0 };
+      break;
+    case 180:
+      *t = { -1, 0, matrix_width - 1, 0, -1, matrix_height - 1 };
+      break;
+    case 270:
+      *t = { 0, 1, 0, -1, 0, matrix_height - 1 };
+      break;
+    }
+    return true;
+  }
+
 private:
   int angle_;
 };
@@ -141,6 +160,16 @@ public:
     }
   }
 
+  virtual bool GetTransform(int matrix_width, int matrix_height,
+                            PixelTransform *t) const {
+    if (horizontal_) {
+      *t = { -1, 0, matrix_width - 1, 0, 1, 0 };
+    } else {
+      *t = { 1, 0, 0, 0, -1, matrix_height - 1 };
+    }
+    return true;
+  }
+
 private:
   bool horizontal_;
 };
@@ -0,0 +1,30 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// Convert a BDF font into the binary font format (see
+// Font::WriteBinaryFont()), which Font::LoadFont() maps into memory without
+// any parsing.
+
+#include "graphics.h"
+
+#include <stdio.h>
+
+static int usage(const char *progname) {
+  fprintf(stderr, "usage: %s <input.bdf> <output.rgbfont>\n", progname);
+  return 1;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 3)
+    return usage(argv[0]);
+
+  rgb_matrix::Font font;
+  if (!font.LoadFont(argv[1])) {
+    fprintf(stderr, "Couldn't load font '%s'\n", argv[1]);
+    return 1;
+  }
+  if (!font.WriteBinaryFont(argv[2])) {
+    fprintf(stderr, "Couldn't write '%s'\n", argv[2]);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,304 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// Compare drawing the weather screen through a DrawList, which records
+// everything and writes each pixel once in Flush(), with drawing it
+// straight onto the FrameCanvas. Three frames are replayed on the weather
+// screen's 64x64 panel, rotated by 90 degrees like in matrix-app unless
+// another --led-pixel-mapper is given, with the layout, fonts, icons and
+// colors of WeatherStationModule:
+//   - a day frame: everything redrawn in the day colors,
+//   - a night frame: everything redrawn in the night colors,
+//   - a time-only frame: the date and time erased and redrawn, as every
+//     minute.
+// No GPIO is needed. Both ways have to leave the same bitplanes behind; a
+// mismatch is reported and makes the exit code non-zero. Run from utils/,
+// or give the font directory with -d.
+
+#include "led-matrix.h"
+#include "graphics.h"
+#include "weather-module-images.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+
+using rgb_matrix::Color;
+using rgb_matrix::DrawList;
+using rgb_matrix::Font;
+using rgb_matrix::FrameCanvas;
+using rgb_matrix::RGBMatrix;
+
+namespace images = matrix_weather_images;
+
+// What one forecast column shows.
+struct ForecastColumn {
+  const char *day;  // Abbreviation
+  const uint8_t *icon;
+  const char *high;
+  const char *pop;  // Empty if there is no chance of precipitation.
+};
+
+// Everything a frame shows.
+struct Frame {
+  bool daytime;
+  const char *month_day, *hour_minute, *weekday;
+  const uint8_t *icon;
+  const char *temperature, *high, *feels_like;
+  bool humidex;
+  ForecastColumn forecast[4];
+};
+
+static const Frame kDayFrame = {
+  true, "10-17", "12:41", "SAT",
+  images::large_sun_cloud_mix_icon_option1, "12°", "14°", "9°", false,
+  { { "SU", images::small_rain_icon, "11°", "70%" },
+    { "MO", images::small_snow_rain_icon_option1, "2°", "80%" },
+    { "TU", images::small_snow_icon, "-1°", "60%" },
+    { "WE", images::small_sun_icon, "3°", "" } },
+};
+
+static const Frame kNightFrame = {
+  false, "10-17", "11:58", "SAT",
+  images::large_rain_icon_option1, "-12°", "-8°", "-19°", false,
+  { { "SU", images::small_freezing_rain_icon, "-3°", "60%" },
+    { "MO", images::small_light_flurries_icon, "-1°", "40%" },
+    { "TU", images::small_cloud_icon, "-7°", "" },
+    { "WE", images::small_thunder_showers_icon_option1, "12°", "40%" } },
+};
+
+// Draws straight onto the canvas.
+class DirectTarget {
+public:
+  explicit DirectTarget(FrameCanvas *canvas) : canvas_(canvas) {}
+
+  void Fill(const Color &c) { canvas_->Fill(c.r, c.g, c.b); }
+  void FillRectangle(int x, int y, int width, int height, const Color &c) {
+    rgb_matrix::FillRectangle(canvas_, x, y, width, height, c);
+  }
+  void DrawLine(int x0, int y0, int x1, int y1, const Color &c) {
+    rgb_matrix::DrawLine(canvas_, x0, y0, x1, y1, c);
+  }
+  void SetImage(int x, int y, const uint8_t *image, size_t size,
+                int width, int height) {
+    rgb_matrix::SetImage(canvas_, x, y, image, size, width, height, false);
+  }
+  void DrawText(const Font &font, int x, int y, const Color &c,
+                const char *text) {
+    rgb_matrix::DrawText(canvas_, font, x, y, c, NULL, text, 0);
+  }
+  void Flush() {}
+
+private:
+  FrameCanvas *const canvas_;
+};
+
+// Records into a DrawList and draws it all in Flush().
+class DrawListTarget {
+public:
+  explicit DrawListTarget(FrameCanvas *canvas) : canvas_(canvas) {}
+
+  void Fill(const Color &c) { list_.Fill(c); }
+  void FillRectangle(int x, int y, int width, int height, const Color &c) {
+    list_.FillRectangle(x, y, width, height, c);
+  }
+  void DrawLine(int x0, int y0, int x1, int y1, const Color &c) {
+    list_.DrawLine(x0, y0, x1, y1, c);
+  }
+  void SetImage(int x, int y, const uint8_t *image, size_t size,
+                int width, int height) {
+    list_.SetImage(x, y, image, size, width, height, false);
+  }
+  void DrawText(const Font &font, int x, int y, const Color &c,
+                const char *text) {
+    list_.DrawText(font, x, y, c, NULL, text, 0);
+  }
+  void Flush() { list_.Flush(canvas_); }
+
+private:
+  FrameCanvas *const canvas_;
+  DrawList list_;
+};
+
+struct Fonts {
+  Font small;        // Everything but the current temperature.
+  Font temperature;  // The current temperature.
+};
+
+// The draw calls of WeatherStationModule::DrawWeatherStationCanvas().
+template <class Target>
+static void DrawFrame(Target *target, const Fonts &fonts, const Frame &frame,
+                      bool date_time_only) {
+  const Font &font = fonts.small;
+  const Color white(255, 255, 255);
+  const bool day = frame.daytime;
+  if (!date_time_only) {
+    target->Fill(Color(0, 0, 0));
+    const Color separator = day ? white : Color(84, 84, 84);
+    target->DrawLine(0, 9, 64, 9, separator);
+    target->DrawLine(0, 36, 64, 36, separator);
+    target->DrawLine(47, 29, 47, 33, separator);
+  }
+
+  target->FillRectangle(0, 0, images::datetime_erase_box_width,
+                        images::datetime_erase_box_height, Color(0, 0, 0));
+  target->DrawText(font, 2, 2 + font.baseline(),
+                   day ? white : Color(120, 120, 120), frame.month_day);
+  target->DrawText(font, 25, 2 + font.baseline(), white, frame.hour_minute);
+  target->DrawText(font, 51, 2 + font.baseline(),
+                   day ? white : Color(111, 49, 152), frame.weekday);
+  if (date_time_only) {
+    target->Flush();
+    return;
+  }
+
+  target->SetImage(4, 13, frame.icon, images::large_weather_icon_size,
+                   images::large_weather_icon_width,
+                   images::large_weather_icon_height);
+  const Font &temperature_font = fonts.temperature;
+  target->DrawText(temperature_font, strlen(frame.temperature) <= 3 ? 44 : 40,
+                   13 + temperature_font.baseline(), white, frame.temperature);
+  target->DrawText(font, strlen(frame.high) <= 3 ? 40 : 36,
+                   29 + font.baseline(), Color(255, 126, 0), frame.high);
+  target->DrawText(font, 50, 29 + font.baseline(),
+                   frame.humidex ? Color(255, 126, 0) : Color(0, 183, 239),
+                   frame.feels_like);
+
+  for (int i = 0; i < 4; ++i) {
+    const ForecastColumn &column = frame.forecast[i];
+    const int x = 17 * i;
+    target->DrawText(font, 3 + x, 38 + font.baseline(),
+                     day ? white : Color(120, 120, 120), column.day);
+    target->SetImage(3 + x, 44, column.icon, images::small_weather_icon_size,
+                     images::small_weather_icon_width,
+                     images::small_weather_icon_height);
+    target->DrawText(font, (strlen(column.high) <= 3 ? 5 : 3) + x,
+                     53 + font.baseline(),
+                     day ? white : Color(120, 120, 120), column.high);
+    if (column.pop[0] != '\0') {
+      target->DrawText(font, 2 + x, 59 + font.baseline(),
+                       day ? white : Color(161, 161, 161), column.pop);
+    }
+  }
+  target->Flush();
+}
+
+static int usage(const char *progname) {
+  fprintf(stderr, "usage: %s [options]\n", progname);
+  fprintf(stderr, "Options:\n"
+          "\t-d <directory>   : Directory with the fonts. Default ../fonts\n"
+          "\t-r <repetitions> : Best of this many runs. Default 100.\n"
+          "\t-n <iterations>  : Frames per run. Default 100.\n\n");
+  rgb_matrix::PrintMatrixFlags(stderr);
+  return 1;
+}
+
+static double NowUsec() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// Microseconds per frame of one run of "iterations" frames.
+template <class Target>
+static double TimeFrame(Target *target, const Fonts &fonts, const Frame &frame,
+                        bool date_time_only, int iterations) {
+  const double start = NowUsec();
+  for (int i = 0; i < iterations; ++i)
+    DrawFrame(target, fonts, frame, date_time_only);
+  return (NowUsec() - start) / iterations;
+}
+
+static std::string Serialized(FrameCanvas *canvas) {
+  const char *data;
+  size_t len;
+  canvas->Serialize(&data, &len);
+  return std::string(data, len);
+}
+
+int main(int argc, char *argv[]) {
+  RGBMatrix::Options matrix_options;
+  rgb_matrix::RuntimeOptions runtime_opt;
+  matrix_options.rows = 64;  // The weather screen's panel.
+  matrix_options.cols = 64;
+  matrix_options.pixel_mapper_config = "Rotate:90";
+  if (!rgb_matrix::ParseOptionsFromFlags(&argc, &argv,
+                                         &matrix_options, &runtime_opt)) {
+    return usage(argv[0]);
+  }
+  runtime_opt.do_gpio_init = false;  // Only the framebuffer is needed.
+
+  std::string font_dir = "../fonts";
+  int reps = 100;
+  int iterations = 100;
+  int opt;
+  while ((opt = getopt(argc, argv, "d:r:n:")) != -1) {
+    switch (opt) {
+    case 'd': font_dir = optarg; break;
+    case 'r': reps = atoi(optarg); break;
+    case 'n': iterations = atoi(optarg); break;
+    default:
+      return usage(argv[0]);
+    }
+  }
+
+  Fonts fonts;
+  const std::string small_font = font_dir + "/tom-thumb_fixed_4x6.bdf";
+  const std::string temperature_font = font_dir + "/8x13_custom.bdf";
+  if (!fonts.small.LoadFont(small_font.c_str())
+      || !fonts.temperature.LoadFont(temperature_font.c_str())) {
+    fprintf(stderr, "Couldn't load the fonts from '%s'\n", font_dir.c_str());
+    return usage(argv[0]);
+  }
+
+  RGBMatrix *matrix = RGBMatrix::CreateFromOptions(matrix_options,
+                                                   runtime_opt);
+  if (matrix == NULL)
+    return 1;
+  FrameCanvas *direct_canvas = matrix->CreateFrameCanvas();
+  FrameCanvas *list_canvas = matrix->CreateFrameCanvas();
+  DirectTarget direct(direct_canvas);
+  DrawListTarget list(list_canvas);
+
+  struct Replay {
+    const char *name;
+    const Frame *frame;
+    bool date_time_only;
+  };
+  static const Replay replays[] = {
+    { "day frame", &kDayFrame, false },
+    { "night frame", &kNightFrame, false },
+    { "time-only frame", &kDayFrame, true },
+  };
+
+  bool all_match = true;
+  printf("%-16s %12s %14s %8s\n", "", "direct us", "DrawList us",
+         "speedup");
+  for (const Replay &replay : replays) {
+    // A time-only frame draws on top of a full one.
+    if (replay.date_time_only) {
+      DrawFrame(&direct, fonts, *replay.frame, false);
+      DrawFrame(&list, fonts, *replay.frame, false);
+    }
+    // Alternate the two, so both see the same machine noise.
+    double direct_usec = 1e18, list_usec = 1e18;
+    for (int rep = 0; rep < reps; ++rep) {
+      direct_usec = std::min(direct_usec,
+                             TimeFrame(&direct, fonts, *replay.frame,
+                                       replay.date_time_only, iterations));
+      list_usec = std::min(list_usec,
+                           TimeFrame(&list, fonts, *replay.frame,
+                                     replay.date_time_only, iterations));
+    }
+    const bool match = Serialized(direct_canvas) == Serialized(list_canvas);
+    all_match &= match;
+    printf("%-16s %12.2f %14.2f %7.2fx%s\n", replay.name, direct_usec,
+           list_usec, direct_usec / list_usec, match ? "" : "  MISMATCH");
+  }
+  delete matrix;
+  return all_match ? 0 : 1;
+}
@@ -0,0 +1,252 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// Check and time how the weather screen classifies the forecasts of a
+// citypage XML document: WeatherStationModule::extractForecastPeriod() on
+// each textForecastName, and extractWeatherType() on each icon code and
+// abbreviated text summary. Defaults to the sample s0000439_e.xml next to
+// this file.
+//
+// The classifiers are first checked against their keyword tables: every
+// keyword on its own has to give its own value, which fails if a keyword
+// comes after one it contains. Phrases that contain more than one keyword,
+// like "Tonight" and "Freezing rain", have to give the more specific value.
+// The forecasts of the document have to be told apart from days the same
+// as the std::regex did that decided this before. Any mismatch is reported
+// and makes the exit code non-zero.
+//
+// The time per forecast is compared with that std::regex.
+
+#include "weather-station-module.hpp"
+#include "pugixml.hpp"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <regex>
+#include <string>
+#include <vector>
+
+using WeatherStation::ForecastPeriod;
+using WeatherStation::WeatherStationModule;
+using WeatherStation::WeatherType;
+
+static const char *const kPeriodNames[] = { "TODAY", "TONIGHT", "NIGHT", "DAY" };
+
+static int usage(const char *progname) {
+  fprintf(stderr, "usage: %s [options] [citypage.xml]\n", progname);
+  fprintf(stderr, "Options:\n"
+          "\t-r <repetitions> : Best of this many runs. Default 50.\n"
+          "\t-n <iterations>  : Passes over all forecasts per run. "
+          "Default 200.\n");
+  return 1;
+}
+
+static double NowNsec() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+struct Forecast {
+  std::string name;     // textForecastName
+  int icon_code;        // -1 if there is none
+  std::string summary;  // Abbreviated text summary
+};
+
+// Each failed check is printed; returns the number of failures.
+static int CheckPeriod(const char *name, ForecastPeriod expected) {
+  const ForecastPeriod period
+    = WeatherStationModule::extractForecastPeriod(name);
+  if (period == expected) return 0;
+  printf("FAIL: period of '%s' is %s, expected %s\n", name,
+         kPeriodNames[period], kPeriodNames[expected]);
+  return 1;
+}
+
+static int CheckType(int icon_code, const char *summary, WeatherType expected) {
+  const WeatherType type
+    = WeatherStationModule::extractWeatherType(icon_code, summary);
+  if (type == expected) return 0;
+  printf("FAIL: type of icon %d '%s' is %s, expected %s\n", icon_code, summary,
+         WeatherStation::weatherTypeString[type].c_str(),
+         WeatherStation::weatherTypeString[expected].c_str());
+  return 1;
+}
+
+// Keyword with its first letter in upper case, as in the feed.
+static std::string Capitalized(const char *keyword) {
+  std::string text = keyword;
+  text[0] = toupper(text[0]);
+  return text;
+}
+
+static int CheckClassifiers(int *checks) {
+  int failures = 0;
+  *checks = 0;
+  for (const auto &entry : WeatherStationModule::periodKeywords) {
+    failures += CheckPeriod(Capitalized(entry.first).c_str(), entry.second);
+    ++*checks;
+  }
+  for (const auto &entry : WeatherStationModule::summaryKeywords) {
+    failures += CheckType(-1, Capitalized(entry.first).c_str(), entry.second);
+    ++*checks;
+  }
+
+  using namespace WeatherStation;
+  static const struct { const char *name; ForecastPeriod period; } periods[] = {
+    { "Today", TODAY },
+    { "Tonight", TONIGHT },
+    { "Sunday night", NIGHT },
+    { "Sunday", DAY },
+    { "Wednesday", DAY },
+  };
+  for (const auto &c : periods) {
+    failures += CheckPeriod(c.name, c.period);
+    ++*checks;
+  }
+  static const struct {
+    int icon_code;
+    const char *summary;
+    WeatherType type;
+  } types[] = {
+    { -1, "Freezing rain", FREEZING_RAIN },
+    { -1, "Periods of freezing drizzle", FREEZING_RAIN },
+    { -1, "Rain mixed with ice pellets", FREEZING_RAIN },
+    { -1, "Chance of rain showers or thunderstorms", THUNDERSHOWERS },
+    { -1, "Periods of rain or snow", RAIN_SNOW },
+    { -1, "Snow and rain", RAIN_SNOW },
+    { -1, "Chance of flurries", LIGHT_FLURRIES },
+    { -1, "Chance of drizzle", LIGHT_RAIN },
+    { -1, "Rain at times heavy", RAIN },
+    { -1, "Mostly cloudy", MOSTLY_CLOUDY },
+    { -1, "A mix of sun and cloud", PARTLY_CLOUDY },
+    { -1, "Cloudy periods", PARTLY_CLOUDY },
+    { -1, "Fog patches", UNKNOWN },
+    { 14, "Sunny", FREEZING_RAIN },  // The icon code decides if known.
+    { 33, "Cloudy periods", PARTLY_CLOUDY },
+  };
+  for (const auto &c : types) {
+    failures += CheckType(c.icon_code, c.summary, c.type);
+    ++*checks;
+  }
+  return failures;
+}
+
+// What the parser did before to skip forecasts that aren't for a day.
+static bool RegexIsNightOrToday(const char *name) {
+  std::regex nightOrTodayRegex("(night)|(today)", std::regex_constants::icase);
+  return std::regex_search(name, nightOrTodayRegex);
+}
+
+int main(int argc, char *argv[]) {
+  int reps = 50;
+  int iterations = 200;
+  int opt;
+  while ((opt = getopt(argc, argv, "r:n:")) != -1) {
+    switch (opt) {
+    case 'r': reps = atoi(optarg); break;
+    case 'n': iterations = atoi(optarg); break;
+    default:
+      return usage(argv[0]);
+    }
+  }
+  if (argc - optind > 1)
+    return usage(argv[0]);
+  const char *filename = optind < argc ? argv[optind] : "s0000439_e.xml";
+
+  int checks;
+  const int failures = CheckClassifiers(&checks);
+  printf("%d of %d classifier checks passed.\n", checks - failures, checks);
+  int disagreements = 0;
+
+  pugi::xml_document doc;
+  if (!doc.load_file(filename)) {
+    fprintf(stderr, "Couldn't parse '%s'\n", filename);
+    return 1;
+  }
+  std::vector<Forecast> forecasts;
+  for (pugi::xml_node forecast = doc.child("siteData").child("forecastGroup")
+         .child("forecast"); forecast;
+       forecast = forecast.next_sibling("forecast")) {
+    const pugi::xml_node abbreviated = forecast.child("abbreviatedForecast");
+    forecasts.push_back({
+        forecast.child("period").attribute("textForecastName").value(),
+        abbreviated.child("iconCode").text().as_int(-1),
+        abbreviated.child("textSummary").text().get() });
+  }
+  if (forecasts.empty()) {
+    fprintf(stderr, "No forecasts in '%s'\n", filename);
+    return 1;
+  }
+
+  printf("\n%-18s %-8s %-5s %-28s %s\n", "textForecastName", "period", "icon",
+         "textSummary", "type (icon / text only)");
+  for (const Forecast &f : forecasts) {
+    const ForecastPeriod period
+      = WeatherStationModule::extractForecastPeriod(f.name.c_str());
+    const bool regex_day = !RegexIsNightOrToday(f.name.c_str());
+    if (regex_day != (period == WeatherStation::DAY)) ++disagreements;
+    printf("%-18s %-8s %-5d %-28s %s / %s%s\n", f.name.c_str(),
+           kPeriodNames[period], f.icon_code, f.summary.c_str(),
+           WeatherStation::weatherTypeString[
+             WeatherStationModule::extractWeatherType(
+               f.icon_code, f.summary.c_str())].c_str(),
+           WeatherStation::weatherTypeString[
+             WeatherStationModule::extractWeatherType(
+               -1, f.summary.c_str())].c_str(),
+           regex_day == (period == WeatherStation::DAY)
+             ? "" : "  FAIL: the regex disagrees");
+  }
+
+  // Alternate all of them, so each sees the same machine noise.
+  double best_regex = 1e18, best_period = 1e18;
+  double best_type = 1e18, best_text = 1e18;
+  for (int rep = 0; rep < reps; ++rep) {
+    double start = NowNsec();
+    for (int i = 0; i < iterations; ++i) {
+      for (const Forecast &f : forecasts)
+        RegexIsNightOrToday(f.name.c_str());
+    }
+    best_regex = std::min(best_regex, NowNsec() - start);
+
+    start = NowNsec();
+    for (int i = 0; i < iterations; ++i) {
+      for (const Forecast &f : forecasts)
+        WeatherStationModule::extractForecastPeriod(f.name.c_str());
+    }
+    best_period = std::min(best_period, NowNsec() - start);
+
+    start = NowNsec();
+    for (int i = 0; i < iterations; ++i) {
+      for (const Forecast &f : forecasts) {
+        WeatherStationModule::extractWeatherType(f.icon_code,
+                                                 f.summary.c_str());
+      }
+    }
+    best_type = std::min(best_type, NowNsec() - start);
+
+    start = NowNsec();
+    for (int i = 0; i < iterations; ++i) {
+      for (const Forecast &f : forecasts)
+        WeatherStationModule::extractWeatherType(-1, f.summary.c_str());
+    }
+    best_text = std::min(best_text, NowNsec() - start);
+  }
+
+  const double per_forecast = 1.0 * iterations * forecasts.size();
+  printf("\nns per forecast, best of %d runs over %d forecasts:\n", reps,
+         (int)forecasts.size());
+  printf("  %-40s %10.1f\n", "std::regex night/today (before)",
+         best_regex / per_forecast);
+  printf("  %-40s %10.1f\n", "extractForecastPeriod()",
+         best_period / per_forecast);
+  printf("  %-40s %10.1f\n", "extractWeatherType()",
+         best_type / per_forecast);
+  printf("  %-40s %10.1f\n", "extractWeatherType(), text only",
+         best_text / per_forecast);
+  return (failures == 0 && disagreements == 0) ? 0 : 1;
+}
@@ -0,0 +1,162 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// Measure the size of the pixel map and the cost of SetPixel() for a range
+// of chain lengths. Every SetPixel() looks up the pixel's PixelDesignator,
+// so once the map no longer fits into the cache, scattered drawing gets
+// slower; the map size per pixel decides at which chain length that happens.
+//
+// Each chain length is timed writing the canvas in order and in a
+// pseudo-random order. Where the kernel exposes hardware counters, the cache
+// misses per pixel are reported as well. No GPIO is needed.
+
+#include "led-matrix.h"
+#include "framebuffer-internal.h"
+
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+using rgb_matrix::FrameCanvas;
+using rgb_matrix::RGBMatrix;
+
+static int usage(const char *progname) {
+  fprintf(stderr, "usage: %s [options] [chain-length...]\n", progname);
+  fprintf(stderr, "Chain lengths default to 1 4 16 64 128.\n"
+          "Options:\n"
+          "\t-r <repetitions> : Best of this many runs. Default 15.\n\n");
+  rgb_matrix::PrintMatrixFlags(stderr);
+  return 1;
+}
+
+static double NowNsec() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Counts the cache misses of this thread, if the kernel lets us.
+class CacheMissCounter {
+public:
+  CacheMissCounter() {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd_ = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+  ~CacheMissCounter() { if (fd_ >= 0) close(fd_); }
+
+  bool available() const { return fd_ >= 0; }
+  void Start() {
+    if (fd_ < 0) return;
+    ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+  }
+  uint64_t Stop() {
+    uint64_t count = 0;
+    if (fd_ < 0) return 0;
+    ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(fd_, &count, sizeof(count)) != sizeof(count)) return 0;
+    return count;
+  }
+
+private:
+  int fd_;
+};
+
+struct Timing {
+  double nsec_per_pixel;
+  double misses_per_pixel;
+};
+
+// Best of "reps" runs of writing the pixels in "order" (x + y * width).
+static Timing TimeSetPixel(FrameCanvas *canvas, const std::vector<uint32_t> &order,
+                           int reps, CacheMissCounter *counter) {
+  const int width = canvas->width();
+  Timing best = { 1e18, 1e18 };
+  for (int rep = 0; rep < reps; ++rep) {
+    counter->Start();
+    const double start = NowNsec();
+    for (size_t i = 0; i < order.size(); ++i) {
+      const int x = order[i] % width, y = order[i] / width;
+      canvas->SetPixel(x, y, x * 4, y * 4, rep + i);
+    }
+    const double nsec = (NowNsec() - start) / order.size();
+    const double misses = (double)counter->Stop() / order.size();
+    if (nsec < best.nsec_per_pixel) best.nsec_per_pixel = nsec;
+    if (misses < best.misses_per_pixel) best.misses_per_pixel = misses;
+  }
+  return best;
+}
+
+int main(int argc, char *argv[]) {
+  RGBMatrix::Options matrix_options;
+  rgb_matrix::RuntimeOptions runtime_opt;
+  if (!rgb_matrix::ParseOptionsFromFlags(&argc, &argv,
+                                         &matrix_options, &runtime_opt)) {
+    return usage(argv[0]);
+  }
+  runtime_opt.do_gpio_init = false;  // Only the framebuffer is needed.
+
+  int reps = 15;
+  int opt;
+  while ((opt = getopt(argc, argv, "r:")) != -1) {
+    switch (opt) {
+    case 'r': reps = atoi(optarg); break;
+    default:
+      return usage(argv[0]);
+    }
+  }
+
+  std::vector<int> chains;
+  for (int i = optind; i < argc; ++i) chains.push_back(atoi(argv[i]));
+  if (chains.empty()) chains = { 1, 4, 16, 64, 128 };
+
+  CacheMissCounter counter;
+  printf("%dx%d panels, parallel %d, %d bytes per pixel map entry\n",
+         matrix_options.cols, matrix_options.rows, matrix_options.parallel,
+         (int)sizeof(rgb_matrix::internal::PixelDesignator));
+  printf("chain   pixels   map KiB   in order ns/px   random ns/px%s\n",
+         counter.available() ? "   misses/px (order/random)" : "");
+  for (size_t c = 0; c < chains.size(); ++c) {
+    matrix_options.chain_length = chains[c];
+    RGBMatrix *matrix = RGBMatrix::CreateFromOptions(matrix_options,
+                                                     runtime_opt);
+    if (matrix == NULL)
+      return 1;
+    FrameCanvas *canvas = matrix->CreateFrameCanvas();
+    const uint32_t pixels = canvas->width() * canvas->height();
+
+    std::vector<uint32_t> in_order(pixels), random(pixels);
+    uint32_t seed = 1;
+    for (uint32_t i = 0; i < pixels; ++i) {
+      in_order[i] = i;
+      seed = seed * 1664525u + 1013904223u;  // Numerical Recipes LCG
+      random[i] = seed % pixels;
+    }
+
+    const Timing seq = TimeSetPixel(canvas, in_order, reps, &counter);
+    const Timing rnd = TimeSetPixel(canvas, random, reps, &counter);
+    printf("%5d %8u %9.0f %16.2f %14.2f", chains[c], pixels,
+           pixels * sizeof(rgb_matrix::internal::PixelDesignator) / 1024.0,
+           seq.nsec_per_pixel, rnd.nsec_per_pixel);
+    if (counter.available()) {
+      printf("   %8.3f / %.3f", seq.misses_per_pixel, rnd.misses_per_pixel);
+    }
+    printf("\n");
+    delete matrix;
+  }
+  return 0;
+}
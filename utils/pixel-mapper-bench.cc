@@ -0,0 +1,134 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// Measure how long creating the matrix takes for a number of panel
+// geometries and pixel mapper chains (--led-pixel-mapper). Most of that on
+// big chained installations is building the pixel map through the mappers,
+// so for each chain the time on top of creating the matrix without any
+// mapper is reported as well. No GPIO is needed.
+
+#include "led-matrix.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+using rgb_matrix::RGBMatrix;
+
+struct Geometry {
+  int rows, cols, chain, parallel;
+};
+
+static int usage(const char *progname) {
+  fprintf(stderr, "usage: %s [options] [pixel-mapper-config...]\n", progname);
+  fprintf(stderr, "Mapper configs default to 'Rotate:90', "
+          "'Rotate:90;Mirror:H;Rotate:180' and 'U-mapper;Rotate:90'.\n"
+          "Options:\n"
+          "\t-g <rows>x<cols>x<chain>x<parallel> : Panel geometry to measure; "
+          "can be given\n"
+          "\t                   multiple times. Default 32x32x1x1, 32x64x4x3, "
+          "32x64x16x3,\n"
+          "\t                   64x64x16x3 and 32x64x64x3.\n"
+          "\t-r <repetitions> : Best of this many runs. Default 5.\n\n");
+  rgb_matrix::PrintMatrixFlags(stderr);
+  return 1;
+}
+
+static double NowUsec() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// Best time of creating the matrix, or a negative value if it failed.
+static double TimeCreate(RGBMatrix::Options options,
+                         const rgb_matrix::RuntimeOptions &runtime_opt,
+                         const Geometry &geometry, const char *mapper_config,
+                         int reps) {
+  options.rows = geometry.rows;
+  options.cols = geometry.cols;
+  options.chain_length = geometry.chain;
+  options.parallel = geometry.parallel;
+  options.pixel_mapper_config = mapper_config;
+  double best = -1;
+  for (int rep = 0; rep < reps; ++rep) {
+    const double start = NowUsec();
+    RGBMatrix *matrix = RGBMatrix::CreateFromOptions(options, runtime_opt);
+    const double usec = NowUsec() - start;
+    if (matrix == NULL)
+      return -1;
+    delete matrix;
+    if (best < 0 || usec < best) best = usec;
+  }
+  return best;
+}
+
+int main(int argc, char *argv[]) {
+  RGBMatrix::Options matrix_options;
+  rgb_matrix::RuntimeOptions runtime_opt;
+  matrix_options.hardware_mapping = "regular";  // Allows parallel chains.
+  if (!rgb_matrix::ParseOptionsFromFlags(&argc, &argv,
+                                         &matrix_options, &runtime_opt)) {
+    return usage(argv[0]);
+  }
+  runtime_opt.do_gpio_init = false;  // Only the framebuffer is needed.
+
+  std::vector<Geometry> geometries;
+  int reps = 5;
+  int opt;
+  while ((opt = getopt(argc, argv, "g:r:")) != -1) {
+    switch (opt) {
+    case 'g': {
+      Geometry g;
+      if (sscanf(optarg, "%dx%dx%dx%d",
+                 &g.rows, &g.cols, &g.chain, &g.parallel) != 4) {
+        fprintf(stderr, "Invalid geometry '%s'\n", optarg);
+        return usage(argv[0]);
+      }
+      geometries.push_back(g);
+      break;
+    }
+    case 'r': reps = atoi(optarg); break;
+    default:
+      return usage(argv[0]);
+    }
+  }
+  if (geometries.empty()) {
+    geometries = { { 32, 32, 1, 1 }, { 32, 64, 4, 3 }, { 32, 64, 16, 3 },
+                   { 64, 64, 16, 3 }, { 32, 64, 64, 3 } };
+  }
+
+  std::vector<std::string> mapper_configs;
+  for (int i = optind; i < argc; ++i) mapper_configs.push_back(argv[i]);
+  if (mapper_configs.empty()) {
+    mapper_configs = { "Rotate:90", "Rotate:90;Mirror:H;Rotate:180",
+                       "U-mapper;Rotate:90" };
+  }
+
+  printf("%-32s %-14s %12s %12s\n", "mapper", "geometry",
+         "create us", "mappers us");
+  for (size_t g = 0; g < geometries.size(); ++g) {
+    const Geometry &geometry = geometries[g];
+    char name[64];
+    snprintf(name, sizeof(name), "%dx%dx%dx%d", geometry.rows, geometry.cols,
+             geometry.chain, geometry.parallel);
+    const double unmapped = TimeCreate(matrix_options, runtime_opt, geometry,
+                                       "", reps);
+    printf("%-32s %-14s %12.0f %12s\n", "(none)", name, unmapped, "-");
+    for (size_t m = 0; m < mapper_configs.size(); ++m) {
+      const double usec = TimeCreate(matrix_options, runtime_opt, geometry,
+                                     mapper_configs[m].c_str(), reps);
+      if (usec < 0) {
+        printf("%-32s %-14s %12s %12s\n", mapper_configs[m].c_str(), name,
+               "failed", "-");
+        continue;
+      }
+      printf("%-32s %-14s %12.0f %12.0f\n", mapper_configs[m].c_str(), name,
+             usec, usec - unmapped);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,155 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// Measure the jitter of the refresh loop while a producer hands over frames,
+// with or without triple buffering (--led-triple-buffer). Runs on the
+// emulated GPIO by default, so it works on any Linux machine.
+//
+// The producer spends a configurable time per frame drawing, then hands the
+// frame over with SwapOnVSync() or, with -n, PublishFrame() that does not
+// wait for vsync. Reports the refresh thread timing (see
+// RGBMatrix::GetRefreshStats()) and how often the producer was woken up.
+
+#include "led-matrix.h"
+
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+using rgb_matrix::FrameCanvas;
+using rgb_matrix::RGBMatrix;
+
+volatile bool interrupt_received = false;
+static void InterruptHandler(int signo) {
+  interrupt_received = true;
+}
+
+static int usage(const char *progname) {
+  fprintf(stderr, "usage: %s [options]\n", progname);
+  fprintf(stderr, "Options:\n"
+          "\t-s <seconds>  : Duration of the measurement. Default 5.\n"
+          "\t-w <usec>     : Time the producer spends drawing each frame. "
+          "Default 5000.\n"
+          "\t-n            : Hand over with PublishFrame(), not waiting "
+          "for vsync.\n\n");
+  rgb_matrix::PrintMatrixFlags(stderr);
+  return 1;
+}
+
+static uint64_t NowUsec() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// Upper bound of the bucket the given percentile falls into.
+static unsigned PercentileUsec(const uint64_t *histogram, double percentile) {
+  const int kBuckets = RGBMatrix::RefreshStats::kHistogramBuckets;
+  uint64_t total = 0;
+  for (int i = 0; i < kBuckets; ++i) total += histogram[i];
+  uint64_t seen = 0;
+  for (int i = 0; i < kBuckets; ++i) {
+    seen += histogram[i];
+    if (seen >= total * percentile) return 2u << i;
+  }
+  return 2u << (kBuckets - 1);
+}
+
+static void PrintHistogram(const char *name, const uint64_t *histogram) {
+  printf("%-14s p50 <%6uus  p99 <%6uus  max <%6uus |", name,
+         PercentileUsec(histogram, 0.5), PercentileUsec(histogram, 0.99),
+         PercentileUsec(histogram, 1.0));
+  for (int i = 0; i < RGBMatrix::RefreshStats::kHistogramBuckets; ++i) {
+    printf(" %llu", (unsigned long long)histogram[i]);
+  }
+  printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+  RGBMatrix::Options matrix_options;
+  rgb_matrix::RuntimeOptions runtime_opt;
+  runtime_opt.emulate_gpio = true;
+  runtime_opt.drop_privileges = 0;
+  if (!rgb_matrix::ParseOptionsFromFlags(&argc, &argv,
+                                         &matrix_options, &runtime_opt)) {
+    return usage(argv[0]);
+  }
+
+  int seconds = 5;
+  int work_usec = 5000;
+  bool no_wait = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "s:w:n")) != -1) {
+    switch (opt) {
+    case 's': seconds = atoi(optarg); break;
+    case 'w': work_usec = atoi(optarg); break;
+    case 'n': no_wait = true; break;
+    default:
+      return usage(argv[0]);
+    }
+  }
+
+  RGBMatrix *matrix = RGBMatrix::CreateFromOptions(matrix_options,
+                                                   runtime_opt);
+  if (matrix == NULL)
+    return 1;
+
+  signal(SIGTERM, InterruptHandler);
+  signal(SIGINT, InterruptHandler);
+
+  FrameCanvas *offscreen = matrix->CreateFrameCanvas();
+  struct rusage usage_start, usage_end;
+  getrusage(RUSAGE_THREAD, &usage_start);
+  RGBMatrix::RefreshStats start_stats;
+  matrix->GetRefreshStats(&start_stats);
+
+  const uint64_t start_usec = NowUsec();
+  const uint64_t end_usec = start_usec + seconds * 1000000ull;
+  int produced = 0;
+  while (!interrupt_received && NowUsec() < end_usec) {
+    // Simulate drawing work.
+    const uint64_t work_end = NowUsec() + work_usec;
+    for (int i = 0; NowUsec() < work_end; ++i) {
+      offscreen->SetPixel(i % offscreen->width(),
+                          (i / offscreen->width()) % offscreen->height(),
+                          produced, i, 255 - produced);
+    }
+    offscreen = no_wait
+      ? matrix->PublishFrame(offscreen)
+      : matrix->SwapOnVSync(offscreen);
+    ++produced;
+  }
+  const double elapsed = (NowUsec() - start_usec) / 1e6;
+
+  getrusage(RUSAGE_THREAD, &usage_end);
+  RGBMatrix::RefreshStats stats;
+  matrix->GetRefreshStats(&stats);
+  delete matrix;
+
+  // Only the part measured here.
+  const int kBuckets = RGBMatrix::RefreshStats::kHistogramBuckets;
+  for (int i = 0; i < kBuckets; ++i) {
+    stats.frame_usec[i] -= start_stats.frame_usec[i];
+    stats.dump_usec[i] -= start_stats.dump_usec[i];
+    stats.swap_latency_usec[i] -= start_stats.swap_latency_usec[i];
+  }
+  const long switches
+    = (usage_end.ru_nvcsw + usage_end.ru_nivcsw)
+    - (usage_start.ru_nvcsw + usage_start.ru_nivcsw);
+
+  printf("%s, %s: %.1f refresh Hz, %.1f produced frames/s, "
+         "%llu missed deadlines\n",
+         matrix_options.triple_buffering ? "triple buffer" : "swap",
+         no_wait ? "no wait" : "wait for vsync",
+         (stats.frames - start_stats.frames) / elapsed, produced / elapsed,
+         (unsigned long long)(stats.missed_deadlines
+                              - start_stats.missed_deadlines));
+  printf("producer context switches: %.0f/s\n", switches / elapsed);
+  PrintHistogram("frame", stats.frame_usec);
+  PrintHistogram("dump", stats.dump_usec);
+  PrintHistogram("swap latency", stats.swap_latency_usec);
+  return 0;
+}
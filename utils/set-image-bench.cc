@@ -0,0 +1,179 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// Compare SetImage() onto a FrameCanvas, which writes the whole rectangle
+// through FrameCanvas::SetPixelsFromBuffer(), with setting the same pixels
+// one SetPixel() at a time. The blits are the ones of the weather screen:
+// the date/time erase box, the large current weather icon and the four small
+// forecast icons. Each is timed without a pixel mapper and with Rotate:90,
+// unless a mapper is given with --led-pixel-mapper. No GPIO is needed.
+//
+// Both paths have to leave the same bitplanes behind; a mismatch is
+// reported and makes the exit code non-zero.
+
+#include "led-matrix.h"
+#include "graphics.h"
+#include "weather-module-images.hpp"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using rgb_matrix::FrameCanvas;
+using rgb_matrix::RGBMatrix;
+
+namespace images = matrix_weather_images;
+
+struct Blit {
+  int x, y;
+  const uint8_t *buffer;
+  int width, height;
+};
+
+struct Scene {
+  const char *name;
+  std::vector<Blit> blits;
+};
+
+static int usage(const char *progname) {
+  fprintf(stderr, "usage: %s [options]\n", progname);
+  fprintf(stderr, "Options:\n"
+          "\t-r <repetitions> : Best of this many runs. Default 200.\n"
+          "\t-n <iterations>  : Blits per run. Default 100.\n\n");
+  rgb_matrix::PrintMatrixFlags(stderr);
+  return 1;
+}
+
+static double NowNsec() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// What SetImage() does for a Canvas that is not a FrameCanvas.
+static void SetImagePerPixel(FrameCanvas *canvas, const Blit &blit) {
+  const uint8_t *pixel = blit.buffer;
+  for (int y = blit.y; y < blit.y + blit.height; ++y) {
+    for (int x = blit.x; x < blit.x + blit.width; ++x) {
+      canvas->SetPixel(x, y, pixel[0], pixel[1], pixel[2]);
+      pixel += 3;
+    }
+  }
+}
+
+static void SetImageBulk(FrameCanvas *canvas, const Blit &blit) {
+  rgb_matrix::SetImage(canvas, blit.x, blit.y, blit.buffer,
+                       3 * blit.width * blit.height, blit.width, blit.height,
+                       false);
+}
+
+// Nanoseconds of one run of "iterations" scenes drawn with "draw".
+static double TimeScene(FrameCanvas *canvas, const Scene &scene,
+                        void (*draw)(FrameCanvas *, const Blit &),
+                        int iterations) {
+  const double start = NowNsec();
+  for (int i = 0; i < iterations; ++i) {
+    for (size_t b = 0; b < scene.blits.size(); ++b)
+      draw(canvas, scene.blits[b]);
+  }
+  return (NowNsec() - start) / iterations;
+}
+
+static std::string Serialized(FrameCanvas *canvas) {
+  const char *data;
+  size_t len;
+  canvas->Serialize(&data, &len);
+  return std::string(data, len);
+}
+
+int main(int argc, char *argv[]) {
+  RGBMatrix::Options matrix_options;
+  rgb_matrix::RuntimeOptions runtime_opt;
+  matrix_options.rows = 64;  // The weather screen's panel.
+  matrix_options.cols = 64;
+  if (!rgb_matrix::ParseOptionsFromFlags(&argc, &argv,
+                                         &matrix_options, &runtime_opt)) {
+    return usage(argv[0]);
+  }
+  runtime_opt.do_gpio_init = false;  // Only the framebuffer is needed.
+
+  int reps = 200;
+  int iterations = 100;
+  int opt;
+  while ((opt = getopt(argc, argv, "r:n:")) != -1) {
+    switch (opt) {
+    case 'r': reps = atoi(optarg); break;
+    case 'n': iterations = atoi(optarg); break;
+    default:
+      return usage(argv[0]);
+    }
+  }
+
+  std::vector<std::string> mapper_configs;
+  if (matrix_options.pixel_mapper_config != NULL) {
+    mapper_configs.push_back(matrix_options.pixel_mapper_config);
+  } else {
+    mapper_configs = { "", "Rotate:90" };
+  }
+
+  // The erase box used to be a black image blitted over the date and time.
+  const std::vector<uint8_t> erase_box(3 * images::datetime_erase_box_width
+                                       * images::datetime_erase_box_height, 0);
+  std::vector<Scene> scenes(3);
+  scenes[0].name = "erase box 64x9";
+  scenes[0].blits.push_back({ 0, 0, erase_box.data(),
+                              images::datetime_erase_box_width,
+                              images::datetime_erase_box_height });
+  scenes[1].name = "large icon 20x20";
+  scenes[1].blits.push_back({ 4, 13, images::large_rain_icon_option1,
+                              images::large_weather_icon_width,
+                              images::large_weather_icon_height });
+  scenes[2].name = "4 small icons 8x8";
+  for (int i = 0; i < 4; ++i) {
+    scenes[2].blits.push_back({ 3 + 17 * i, 44, images::small_sun_icon,
+                                images::small_weather_icon_width,
+                                images::small_weather_icon_height });
+  }
+
+  bool all_match = true;
+  printf("%-12s %-20s %14s %14s %8s\n", "mapper", "blit",
+         "SetPixel ns", "SetImage ns", "speedup");
+  for (size_t m = 0; m < mapper_configs.size(); ++m) {
+    matrix_options.pixel_mapper_config = mapper_configs[m].c_str();
+    RGBMatrix *matrix = RGBMatrix::CreateFromOptions(matrix_options,
+                                                     runtime_opt);
+    if (matrix == NULL)
+      return 1;
+    FrameCanvas *per_pixel = matrix->CreateFrameCanvas();
+    FrameCanvas *bulk = matrix->CreateFrameCanvas();
+    const char *mapper_name = mapper_configs[m].empty()
+      ? "(none)" : mapper_configs[m].c_str();
+
+    for (size_t s = 0; s < scenes.size(); ++s) {
+      const Scene &scene = scenes[s];
+      per_pixel->Fill(10, 20, 30);
+      bulk->Fill(10, 20, 30);
+      // Alternate the two, so both see the same machine noise.
+      double per_pixel_ns = 1e18, bulk_ns = 1e18;
+      for (int rep = 0; rep < reps; ++rep) {
+        per_pixel_ns = std::min(per_pixel_ns, TimeScene(per_pixel, scene,
+                                                        SetImagePerPixel,
+                                                        iterations));
+        bulk_ns = std::min(bulk_ns, TimeScene(bulk, scene, SetImageBulk,
+                                              iterations));
+      }
+      const bool match = Serialized(per_pixel) == Serialized(bulk);
+      all_match &= match;
+      printf("%-12s %-20s %14.0f %14.0f %7.2fx%s\n", mapper_name, scene.name,
+             per_pixel_ns, bulk_ns, per_pixel_ns / bulk_ns,
+             match ? "" : "  MISMATCH");
+    }
+    delete matrix;
+  }
+  return all_match ? 0 : 1;
+}
@@ -0,0 +1,210 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// Compare the two ways of handing a downloaded citypage XML document to
+// pugixml: load_string(), which copies the text into a buffer of its own
+// before parsing, and load_buffer_inplace(), which parses the downloaded
+// buffer itself. The weather screen uses the latter.
+//
+// Reported are the most memory pugixml held at once, the peak resident set
+// size and the time per parse. The memory is measured parsing in a process
+// of its own for each way, so the peak resident set size is its own; the
+// two ways are timed alternately, so both see the same machine noise. Every
+// parse starts from a fresh copy of the file, like every fetch starts from
+// a fresh response body. Defaults to the sample s0000439_e.xml next to this
+// file.
+
+#include "pugixml.hpp"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+static int usage(const char *progname) {
+  fprintf(stderr, "usage: %s [options] [citypage.xml]\n", progname);
+  fprintf(stderr, "Options:\n"
+          "\t-r <repetitions> : Best of this many runs. Default 50.\n"
+          "\t-n <iterations>  : Parses per run. Default 100.\n");
+  return 1;
+}
+
+static double NowUsec() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// Memory held by pugixml right now and at most so far.
+static size_t pugixml_bytes = 0;
+static size_t pugixml_peak_bytes = 0;
+
+// pugixml's allocation functions don't get told the size on deallocation,
+// so it is kept in front of each block.
+static void *CountingAllocate(size_t size) {
+  size_t *block = static_cast<size_t *>(malloc(sizeof(max_align_t) + size));
+  if (block == NULL) return NULL;
+  *block = size;
+  pugixml_bytes += size;
+  if (pugixml_bytes > pugixml_peak_bytes) pugixml_peak_bytes = pugixml_bytes;
+  return reinterpret_cast<char *>(block) + sizeof(max_align_t);
+}
+
+static void CountingDeallocate(void *ptr) {
+  if (ptr == NULL) return;
+  size_t *block = reinterpret_cast<size_t *>(static_cast<char *>(ptr)
+                                             - sizeof(max_align_t));
+  pugixml_bytes -= *block;
+  free(block);
+}
+
+static long MaxRssKiB() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+// Parse "xml" the given way; it is garbled afterwards if parsed in place.
+static bool Load(pugi::xml_document *doc, std::string &xml, bool inplace) {
+  pugi::xml_parse_result result = inplace
+    ? doc->load_buffer_inplace(&xml[0], xml.size(), pugi::parse_default,
+                               pugi::encoding_utf8)
+    : doc->load_string(xml.c_str());
+  return result;
+}
+
+static int CountNodes(const pugi::xml_node &node) {
+  int count = 1;
+  for (pugi::xml_node child = node.first_child(); child;
+       child = child.next_sibling()) {
+    count += CountNodes(child);
+  }
+  return count;
+}
+
+struct MemoryUse {
+  size_t pugixml_peak_bytes;
+  long max_rss_kib;
+};
+
+// Memory used parsing the given way in a process of its own, or false.
+static bool MeasureMemory(const std::string &original, bool inplace,
+                          MemoryUse *use) {
+  int result_pipe[2];
+  if (pipe(result_pipe) != 0) {
+    perror("pipe");
+    return false;
+  }
+  const pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    return false;
+  }
+  if (pid == 0) {
+    close(result_pipe[0]);
+    std::string xml = original;
+    pugi::xml_document doc;
+    Load(&doc, xml, inplace);
+    const MemoryUse child_use = { pugixml_peak_bytes, MaxRssKiB() };
+    const bool written = write(result_pipe[1], &child_use, sizeof(child_use))
+      == sizeof(child_use);
+    _exit(written ? 0 : 1);
+  }
+  close(result_pipe[1]);
+  const bool received = read(result_pipe[0], use, sizeof(*use))
+    == sizeof(*use);
+  close(result_pipe[0]);
+  int status;
+  return waitpid(pid, &status, 0) == pid && received;
+}
+
+// Microseconds per parse of one run of "iterations" parses.
+static double TimeLoad(const std::string &original, bool inplace,
+                       int iterations) {
+  const double start = NowUsec();
+  for (int i = 0; i < iterations; ++i) {
+    std::string xml = original;
+    pugi::xml_document doc;
+    Load(&doc, xml, inplace);
+  }
+  return (NowUsec() - start) / iterations;
+}
+
+int main(int argc, char *argv[]) {
+  int reps = 50;
+  int iterations = 100;
+  int opt;
+  while ((opt = getopt(argc, argv, "r:n:")) != -1) {
+    switch (opt) {
+    case 'r': reps = atoi(optarg); break;
+    case 'n': iterations = atoi(optarg); break;
+    default:
+      return usage(argv[0]);
+    }
+  }
+  if (argc - optind > 1)
+    return usage(argv[0]);
+  const char *filename = optind < argc ? argv[optind] : "s0000439_e.xml";
+  pugi::set_memory_management_functions(CountingAllocate, CountingDeallocate);
+
+  std::ifstream file(filename, std::ios::binary);
+  if (!file) {
+    fprintf(stderr, "Couldn't open '%s'\n", filename);
+    return 1;
+  }
+  std::stringstream contents;
+  contents << file.rdbuf();
+  const std::string original = contents.str();
+
+  // Before anything is parsed here, so that the processes measuring the
+  // memory don't start out with the memory of other parses.
+  MemoryUse use[2];
+  for (int inplace = 0; inplace < 2; ++inplace) {
+    if (!MeasureMemory(original, inplace, &use[inplace]))
+      return 1;
+  }
+
+  // Both ways have to see the same document.
+  int nodes[2];
+  for (int inplace = 0; inplace < 2; ++inplace) {
+    std::string xml = original;
+    pugi::xml_document doc;
+    if (!Load(&doc, xml, inplace)) {
+      fprintf(stderr, "Couldn't parse '%s'\n", filename);
+      return 1;
+    }
+    nodes[inplace] = CountNodes(doc);
+  }
+  if (nodes[0] != nodes[1]) {
+    fprintf(stderr, "load_string() saw %d nodes, load_buffer_inplace() %d\n",
+            nodes[0], nodes[1]);
+    return 1;
+  }
+
+  double best[2] = { 1e18, 1e18 };
+  for (int rep = 0; rep < reps; ++rep) {
+    for (int inplace = 0; inplace < 2; ++inplace) {
+      best[inplace] = std::min(best[inplace],
+                               TimeLoad(original, inplace, iterations));
+    }
+  }
+
+  printf("%s: %d bytes, %d nodes\n", filename, (int)original.size(),
+         nodes[0]);
+  printf("%-20s %16s %14s %10s\n", "", "pugixml peak KiB", "peak RSS KiB",
+         "us/parse");
+  for (int inplace = 0; inplace < 2; ++inplace) {
+    printf("%-20s %16.1f %14ld %10.1f\n",
+           inplace ? "load_buffer_inplace" : "load_string",
+           use[inplace].pugixml_peak_bytes / 1024.0, use[inplace].max_rss_kib,
+           best[inplace]);
+  }
+  return 0;
+}